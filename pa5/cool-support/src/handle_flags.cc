@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include "cool-io.h"
 #include <unistd.h>
+#include <getopt.h>
 #include "cgen_gc.h"
 
 //
@@ -29,7 +30,11 @@ extern int cool_yydebug;        // for the parser
        int cgen_debug;          // for code gen
        bool disable_reg_alloc;  // Don't do register allocation
 
-       int cgen_optimize;       // optimize switch for code generator 
+       int cgen_optimize;       // optimization level for code generator 
+       int cgen_time_passes;    // report the time of each optimization pass
+       char *cgen_runtime;      // runtime bitcode to link before optimizing
+       int cgen_jobs;           // worker threads for per-class code gen
+       int cgen_copy_output;    // buffer the output, copy it to the file at the end
        char *out_filename;      // file name for generated code
        Memmgr cgen_Memmgr = GC_NOGC;      // enable/disable garbage collection
        Memmgr_Test cgen_Memmgr_Test = GC_NORMAL;  // normal/test GC
@@ -50,10 +55,21 @@ void handle_flags(int argc, char *argv[]) {
   semant_debug = 0;
   cgen_debug = 0;
   cgen_optimize = 0;
+  cgen_time_passes = 0;
+  cgen_runtime = NULL;
+  cgen_jobs = 1;
+  cgen_copy_output = 0;
   disable_reg_alloc = 0;
   
 
-  while ((c = getopt(argc, argv, "lpscvrOo:gtT")) != -1) {
+  static struct option long_opts[] = {
+    {"time-passes", no_argument, NULL, 'P'},
+    {"runtime", required_argument, NULL, 'R'},
+    {"semispace", no_argument, NULL, 'S'},
+    {NULL, 0, NULL, 0}
+  };
+
+  while ((c = getopt_long_only(argc, argv, "lpscvrO::o:gtTj:m", long_opts, NULL)) != -1) {
     switch (c) {
 #ifdef DEBUG
     case 'l':
@@ -85,7 +101,11 @@ void handle_flags(int argc, char *argv[]) {
       break;
 #endif
     case 'g':  // enable garbage collection
-      cgen_Memmgr = GC_GENGC;
+      if (cgen_Memmgr == GC_NOGC)
+        cgen_Memmgr = GC_GENGC;
+      break;
+    case 'S':  // -semispace: copying collection instead of generational
+      cgen_Memmgr = GC_SNCGC;
       break;
     case 't':  // run garbage collection very frequently (on every allocation)
       cgen_Memmgr_Test = GC_TEST;
@@ -96,8 +116,24 @@ void handle_flags(int argc, char *argv[]) {
     case 'o':  // set the name of the output file
       out_filename = optarg;
       break;
-    case 'O':  // enable optimization
-      cgen_optimize = 1;
+    case 'O':  // enable optimization: -O is -O1, levels 0 to 3
+      cgen_optimize = optarg ? atoi(optarg) : 1;
+      if (cgen_optimize < 0 || cgen_optimize > 3)
+        unknownopt = 1;
+      break;
+    case 'P':  // -time-passes
+      cgen_time_passes = 1;
+      break;
+    case 'R':  // -runtime coolrt.bc
+      cgen_runtime = optarg;
+      break;
+    case 'j':  // generate classes on this many threads
+      cgen_jobs = atoi(optarg);
+      if (cgen_jobs < 1)
+        unknownopt = 1;
+      break;
+    case 'm':  // copy the whole output into the file at the end
+      cgen_copy_output = 1;
       break;
     case '?':
       unknownopt = 1;
@@ -111,9 +147,9 @@ void handle_flags(int argc, char *argv[]) {
   if (unknownopt) {
       cerr << "usage: " << argv[0] << 
 #ifdef DEBUG
-	  " [-lvpscOgtr -o outname] [input-files]\n";
+	  " [-lvpscgtrm -O[0-3] -semispace -time-passes -runtime bc -j jobs -o outname] [input-files]\n";
 #else
-      " [-Ogt -o outname] [input-files]\n";
+      " [-gtm -O[0-3] -semispace -time-passes -runtime bc -j jobs -o outname] [input-files]\n";
 #endif
       exit(1);
   }
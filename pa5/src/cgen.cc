@@ -7,11 +7,64 @@
 
 #define EXTERN
 #include "cgen.h"
+#include "optimizer.h"
+#include "cgen_gc.h"
 #include <string>
 #include <sstream>
+#include <climits>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 
 // 
 extern int cgen_debug;
+extern int cgen_jobs;
+extern int cgen_copy_output;
+extern int cgen_optimize;
+extern int cgen_time_passes;
+extern char *cgen_runtime;
+extern char *out_filename;
+
+// Shared body for every vtable slot whose method is unreachable
+static const char DEAD_METHOD_STUB[] = "dead_method";
+
+// Inlined fast path of the runtime heap allocator (see coolrt.h)
+static const char HEAP_ALLOC[] = "cool_alloc";
+// Bits of cool_gc_flags, as in coolrt.h
+static const int GC_FLAG_ENABLED = 1, GC_FLAG_TEST = 2, GC_FLAG_DEBUG = 4,
+	GC_FLAG_SEMISPACE = 8;
+
+// Indexes of the object size, of the new function and of the first
+// method in a vtable { tag, size, name, gc_map, new, ... } as in coolrt.h
+static const int VTABLE_SIZE_FIELD = 1, VTABLE_NEW_FIELD = 4, 
+	VTABLE_FIRST_METHOD = 5;
+// Index of the raw value in an Int or Bool box, after the vtable pointer
+static const int BOX_VAL_FIELD = 1;
+// Ints in this range, and both Bools, are boxed by a static object
+static const int SMALL_INT_MIN = -128, SMALL_INT_MAX = 1023;
+// Index of the length in a String, 
+// { vtable*, val, len, hash, offset, left, right } as in coolrt.h
+static const int STRING_LEN_FIELD = 2;
+
+// Metadata node with the branch weights of a runtime error check
+static const int MD_UNLIKELY = 2;
+
+// Runtime errors.  Each kind has one noreturn cold stub per module,
+// called with the file index and line of the failing expression.  A site
+// is a call with two constants, about 26 bytes less than printing its
+// own message, and about 11 more than a bare call to abort.
+typedef enum {ERR_DISPATCH_VOID, ERR_CASE_VOID, ERR_CASE_NO_MATCH, 
+	ERR_DIV_ZERO} error_kind;
+static const struct {
+	const char *stub;
+	const char *msg;
+} error_stubs[] = {
+	{ "error.dispatch_void", "%s:%d: Dispatch to void.\n" },
+	{ "error.case_void", "%s:%d: Match on void in case statement.\n" },
+	{ "error.case_no_match", "%s:%d: No match in case statement.\n" },
+	{ "error.div_zero", "%s:%d: Division by zero.\n" },
+};
+static const int NUM_ERROR_STUBS = sizeof(error_stubs) / sizeof(error_stubs[0]);
 
 //////////////////////////////////////////////////////////////////////
 //
@@ -43,6 +96,7 @@ EXTERN Symbol
 	length,
 	concat,
 	substr,
+	main_meth,
 
 	// class members
 	val,
@@ -92,6 +146,7 @@ static void initialize_constants(void)
 	length      = idtable.add_string("length");
 	concat      = idtable.add_string("concat");
 	substr      = idtable.add_string("substr");
+	main_meth   = idtable.add_string("main");
 
 	val         = idtable.add_string("val");
 
@@ -122,7 +177,33 @@ static void initialize_constants(void)
 void program_class::cgen(ostream &os) 
 {
 	initialize_constants();
-	class_table = new CgenClassTable(classes,os);
+	// All code goes through one buffer, written to stdout with fwrite, 
+	// copied into the output file at the end with -m, or to os otherwise
+	IRSink sink;
+	if (&os == &cout)
+		sink.open_file(stdout);
+	else if (!(cgen_copy_output && out_filename && sink.open_copy(out_filename)))
+		sink.open_stream(os);
+
+	// With -O or -runtime the module is kept in memory, linked and
+	// optimized in process and only then written out
+	bool in_process = cgen_optimize || cgen_runtime;
+	IRSink module;
+	ostream s(in_process ? &module : &sink);
+	class_table = new CgenClassTable(classes,s);
+	if (in_process) {
+		string opt;
+		if (optimize_ir(module.data(), module.size(), cgen_optimize, 
+				cgen_runtime, cgen_time_passes, opt))
+			sink.append(opt);
+		else
+			sink.append(module.data(), module.size());
+	}
+	if (!sink.close()) {
+		cerr << "Cannot write output file" << 
+			(out_filename ? string(" ") + out_filename : string()) << endl;
+		exit(1);
+	}
 }
 
 
@@ -165,7 +246,17 @@ void CgenClassTable::setup_external_functions()
 	// setup function: external void abort(void)
 	op_type void_type(VOID);
 	vector<op_type> abort_args;
-	vp.declare(*ct_stream, void_type, "abort", abort_args);
+	func_attrs abort_attrs;
+	abort_attrs.fn = "noreturn nounwind";
+	vp.declare(*ct_stream, void_type, "abort", abort_args, abort_attrs);
+
+	// setup function: external int dprintf(int, sbyte*, ...), for the
+	// runtime error stubs
+	vector<op_type> dprintf_args;
+	dprintf_args.push_back(i32_type);
+	dprintf_args.push_back(i8ptr_type);
+	dprintf_args.push_back(vararg_type);
+	vp.declare(*ct_stream, i32_type, "dprintf", dprintf_args);
 
 	// setup function: external i8* malloc(i32)
 	vector<op_type> malloc_args;
@@ -175,6 +266,84 @@ void CgenClassTable::setup_external_functions()
 #ifdef PA5
 	//ADD CODE HERE
 	//Setup external functions for built in object class functions
+	// Runtime entry points called directly by the intrinsics and by
+	// boxing in conform
+	op_type obj_ptr(Object->get_string(), 1), str_ptr(String->get_string(), 1);
+	op_type int_ptr(Int->get_string(), 1), bool_ptr(Bool->get_string(), 1);
+	// Receivers have been checked for void and allocation never fails
+	func_attrs recv_attrs;
+	recv_attrs.params.push_back("nonnull");
+	func_attrs abort_obj(recv_attrs);
+	abort_obj.fn = "noreturn cold";
+	vp.declare(*ct_stream, obj_ptr, "Object_abort", vector<op_type>(1, obj_ptr),
+		abort_obj);
+	func_attrs fresh;
+	fresh.ret = "nonnull";
+	vp.declare(*ct_stream, obj_ptr, "Object_new", vector<op_type>(), fresh);
+	vp.declare(*ct_stream, int_ptr, "Int_new", vector<op_type>(), fresh);
+	vp.declare(*ct_stream, bool_ptr, "Bool_new", vector<op_type>(), fresh);
+	vp.declare(*ct_stream, str_ptr, "String_new", vector<op_type>(), fresh);
+	func_attrs obj_attrs(fresh);
+	obj_attrs.params = recv_attrs.params;
+	vp.declare(*ct_stream, str_ptr, "Object_type_name", vector<op_type>(1, obj_ptr),
+		obj_attrs);
+	vp.declare(*ct_stream, obj_ptr, "Object_copy", vector<op_type>(1, obj_ptr),
+		obj_attrs);
+	vp.declare(*ct_stream, i32_type, "String_length", vector<op_type>(1, str_ptr),
+		recv_attrs);
+	func_attrs str_attrs(fresh);
+	str_attrs.params = recv_attrs.params;
+	vector<op_type> concat_args(2, str_ptr);
+	vp.declare(*ct_stream, str_ptr, "String_concat", concat_args, str_attrs);
+	vector<op_type> substr_args(1, str_ptr);
+	substr_args.push_back(i32_type);
+	substr_args.push_back(i32_type);
+	vp.declare(*ct_stream, str_ptr, "String_substr", substr_args, str_attrs);
+	func_attrs eq_attrs(recv_attrs);
+	eq_attrs.ret = "zeroext";
+	eq_attrs.params.push_back("nonnull");
+	vp.declare(*ct_stream, op_type(INT1), "String_equal", concat_args, eq_attrs);
+
+	// The IO methods are only called through vtables
+	op_type io_ptr(IO->get_string(), 1);
+	vp.declare(*ct_stream, io_ptr, "IO_new", vector<op_type>(), fresh);
+	vector<op_type> out_string_args(1, io_ptr), out_int_args(1, io_ptr);
+	out_string_args.push_back(str_ptr);
+	out_int_args.push_back(i32_type);
+	vp.declare(*ct_stream, io_ptr, "IO_out_string", out_string_args, obj_attrs);
+	vp.declare(*ct_stream, io_ptr, "IO_out_int", out_int_args, obj_attrs);
+	vp.declare(*ct_stream, str_ptr, "IO_in_string", vector<op_type>(1, io_ptr),
+		obj_attrs);
+	vp.declare(*ct_stream, i32_type, "IO_in_int", vector<op_type>(1, io_ptr),
+		recv_attrs);
+
+	// new and copy fill an object by copying its prototype or original
+	vector<op_type> memcpy_args(2, i8ptr_type);
+	memcpy_args.push_back(i32_type);
+	memcpy_args.push_back(op_type(INT1));
+	vp.declare(*ct_stream, void_type, "llvm.memcpy.p0i8.p0i8.i32", memcpy_args);
+
+	// The runtime heap: bump pointer and limit of the current chunk, and
+	// the allocator behind the inlined fast path
+	vp.init_ext_global(*ct_stream, "cool_heap_ptr", i8ptr_type, true);
+	vp.init_ext_global(*ct_stream, "cool_heap_limit", i8ptr_type, true);
+	func_attrs slow_attrs;
+	slow_attrs.ret = "noalias nonnull";
+	vp.declare(*ct_stream, i8ptr_type, "cool_alloc_slow", 
+		vector<op_type>(1, i32_type), slow_attrs);
+
+	// The collector: shadow stack roots, and for the generational one
+	// (-g) the write barrier marking the card of an object whose
+	// attribute is stored
+	if (cgen_Memmgr != GC_NOGC) {
+		vector<op_type> gcroot_args;
+		gcroot_args.push_back(op_type(INT8_PPTR));
+		gcroot_args.push_back(i8ptr_type);
+		vp.declare(*ct_stream, void_type, "llvm.gcroot", gcroot_args);
+	}
+	if (cgen_Memmgr == GC_GENGC)
+		vp.declare(*ct_stream, void_type, "cool_write_barrier", 
+			vector<op_type>(1, i8ptr_type), recv_attrs);
 #endif
 }
 
@@ -265,6 +434,8 @@ void CgenClassTable::install_basic_classes()
 //
 // The class String has a number of slots and operations:
 //       val                                  the string itself
+// (the runtime's String also has a length, a hash, an offset into val
+// and rope links; see coolrt.h)
 //       length() : Int                       length of the string
 //       concat(arg: Str) : Str               string concatenation
 //       substr(arg: Int, arg2: Int): Str     substring
@@ -450,7 +621,41 @@ CgenNode* CgenClassTable::getMainmain(CgenNode* c)
 void CgenClassTable::code_constants()
 {
 #ifdef PA5
-	// ADD CODE HERE
+	// Every vtable points at the name of its class, and the type_name
+	// intrinsic returns the String constant of one
+	vector<CgenNode*> classes;
+	list_classes(root(), classes);
+	for (unsigned i = 0; i < classes.size(); i++)
+		stringtable.add_string(classes[i]->get_name()->get_string());
+	// and "" is the default of a String attribute in prototypes
+	stringtable.add_string("");
+	stringtable.code_string_table(*ct_stream, this);
+
+	// A box is never modified, so boxing a small Int or a Bool yields
+	// one of these instead of a new object: @Int.small holds the Ints
+	// from SMALL_INT_MIN up, and @Bool.false and @Bool.true the Bools
+	ValuePrinter vp(*ct_stream);
+	op_type int_type(Int->get_string()), bool_type(Bool->get_string());
+	string int_vtbl = "%Int_vtable* @Int_vtable_prototype";
+	string boxes;
+	for (int v = SMALL_INT_MIN; v <= SMALL_INT_MAX; v++)
+		boxes += string(v > SMALL_INT_MIN ? ", " : "") + int_type.get_name() 
+			+ " { " + int_vtbl + ", i32 " + itos(v) + " }";
+	vp.init_constant("Int.small", const_value(op_arr_type(int_type, 
+		SMALL_INT_MAX - SMALL_INT_MIN + 1), "[" + boxes + "]", true));
+
+	op_type bool_vtbl(string(Bool->get_string()) + "_vtable", 1);
+	vector<op_type> fields;
+	fields.push_back(bool_vtbl);
+	fields.push_back(op_type(INT1));
+	for (int b = 0; b < 2; b++) {
+		vector<const_value> init;
+		init.push_back(const_value(bool_vtbl, 
+			"@" + string(Bool->get_string()) + "_vtable_prototype", true));
+		init.push_back(bool_value(b, true));
+		vp.init_struct_constant(global_value(bool_type, 
+			string("Bool.") + (b ? "true" : "false")), fields, init, true);
+	}
 #endif
 }
 
@@ -458,7 +663,37 @@ void CgenClassTable::code_constants()
 void StringEntry::code_def(ostream& s, CgenClassTable* ct)
 {
 #ifdef PA5
-	// ADD CODE HERE
+	// The characters of the literal, as @str.<index>
+	ValuePrinter vp(s);
+	op_arr_type array_type(INT8, len + 1);
+	vp.init_constant("str." + itos(index), const_value(array_type, str, true));
+
+	// and the String every occurrence of it evaluates to, as 
+	// @String.<index>, with the hash of String_hash in coolrt.c, so
+	// that the runtime never writes to it
+	unsigned hash = 2166136261u;
+	for (int i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char) str[i]) * 16777619u;
+	op_type vtbl_ptr(string(String->get_string()) + "_vtable", 1);
+	op_type str_ptr(String->get_string(), 1), i32_type(INT32);
+	vector<op_type> fields;
+	fields.push_back(vtbl_ptr);
+	fields.push_back(op_type(INT8_PTR));
+	for (int i = 0; i < 3; i++)
+		fields.push_back(i32_type);
+	fields.push_back(str_ptr);
+	fields.push_back(str_ptr);
+	vector<const_value> init;
+	init.push_back(const_value(vtbl_ptr, 
+		"@" + string(String->get_string()) + "_vtable_prototype", true));
+	init.push_back(const_value(array_type, "@str." + itos(index), true));
+	init.push_back(const_value(i32_type, itos(len), false));
+	init.push_back(const_value(i32_type, itos((int) (hash ? hash : 1)), false));
+	init.push_back(const_value(i32_type, "0", false));
+	init.push_back(const_value(str_ptr, "null", false));
+	init.push_back(const_value(str_ptr, "null", false));
+	vp.init_struct_constant(global_value(op_type(String->get_string()), 
+		"String." + itos(index)), fields, init, true);
 #endif
 }
 
@@ -479,7 +714,8 @@ void IntEntry::code_def(ostream& s, CgenClassTable* ct)
 // CgenClassTable constructor orchestrates all code generation
 //
 CgenClassTable::CgenClassTable(Classes classes, ostream& s) 
-: nds(0)
+: nds(0), removed_methods(0), removed_attrs(0), num_alloc_sites(0),
+  vtable_ptr_tbaa(0), vtable_tbaa(0)
 {
 	if (cgen_debug) std::cerr << "Building CgenClassTable" << endl;
 	ct_stream = &s;
@@ -510,7 +746,32 @@ CgenClassTable::~CgenClassTable()
 void CgenClassTable::setup()
 {
 	setup_external_functions();
+	SimplifyEnvironment senv;
+	simplify_classes(root(), &senv);
+	if (cgen_debug)
+		std::cerr << "Simplified " << senv.num_simplified 
+			<< " expressions" << endl;
+#ifdef PA5
+	// Must run before layout so that dead attributes get no slot
+	compute_reachability();
+	if (cgen_debug) {
+		report_removed_features(root());
+		std::cerr << "Removed " << removed_methods << " methods and "
+			<< removed_attrs << " attributes" << endl;
+	}
+	// The collector moves objects, so none may live in a frame
+	if (cgen_Memmgr == GC_NOGC)
+		compute_escapes();
+	if (cgen_debug)
+		std::cerr << "Stack-allocated " << stack_sites.size() << " of "
+			<< num_alloc_sites << " allocation sites" << endl;
+#endif
 	setup_classes(root(), 0);
+#ifdef PA5
+	vtable_ptr_tbaa = add_tbaa_node("vtable pointer");
+	vtable_tbaa = add_tbaa_node("vtable");
+	setup_tbaa(root());
+#endif
 }
 
 
@@ -518,6 +779,9 @@ void CgenClassTable::setup_classes(CgenNode *c, int depth)
 {
 	// MAY ADD CODE HERE
 	// if you want to give classes more setup information
+	Symbol file = c->get_filename();
+	if (std::find(source_files.begin(), source_files.end(), file) == source_files.end())
+		source_files.push_back(file);
 
 	c->setup(current_tag++, depth);
 	List<CgenNode> *children = c->get_children();
@@ -539,7 +803,19 @@ void CgenClassTable::setup_classes(CgenNode *c, int depth)
 // emit code for each CgenNode
 void CgenClassTable::code_module()
 {
+#ifdef PA5
+	// Constants need the types of their initializers
+	vector<CgenNode*> classes;
+	list_classes(root(), classes);
+	for (unsigned i = 0; i < classes.size(); i++)
+		classes[i]->code_types(*ct_stream);
+#endif
 	code_constants();
+	code_error_stubs();
+#ifdef PA5
+	code_dead_method_stub();
+	code_heap_alloc();
+#endif
 
 #ifndef PA5
 	// This must be after code_module() since that emits constants
@@ -553,20 +829,156 @@ void CgenClassTable::code_module()
 	code_classes(root());
 #else
 #endif
+	code_metadata();
+}
+
+// Module metadata: the empty node used by the invariant markers, the
+// TBAA root, the weights of error checks, then a TBAA node and access
+// tag per name
+void CgenClassTable::code_metadata()
+{
+	ostream &out = *ct_stream;
+	out << "!0 = !{}\n!1 = !{!\"Cool TBAA\"}\n";
+	out << "!" << MD_UNLIKELY << " = !{!\"branch_weights\", i32 1, i32 1048575}\n";
+	for (unsigned i = 0; i < tbaa_names.size(); i++) {
+		int node = MD_UNLIKELY + 1 + 2 * i;
+		out << "!" << node << " = !{!\"" << tbaa_names[i] << "\", !1, i64 0}\n";
+		out << "!" << node + 1 << " = !{!" << node << ", !" << node 
+			<< ", i64 0}\n";
+	}
+}
+
+int CgenClassTable::get_file_index(Symbol file)
+{
+	vector<Symbol>::iterator i = 
+		std::find(source_files.begin(), source_files.end(), file);
+	assert(i != source_files.end() && "file of a class that was not set up");
+	return i - source_files.begin();
+}
+
+// The error stubs print "file:line: message" on stderr and abort.  Sites
+// pass the index of their file; the names are packed into one array and
+// found through a table of offsets, so the tables need no relocations.
+void CgenClassTable::code_error_stubs()
+{
+	ValuePrinter vp(*ct_stream);
+	op_type i32_type(INT32), i8_ptr(INT8_PTR);
+	int nfiles = source_files.size();
+	string names, offsets;
+	for (int i = 0; i < nfiles; i++) {
+		offsets += string(i ? ", " : "") + "i32 " + itos(names.size());
+		names += source_files[i]->get_string();
+		names += '\0';
+	}
+	names.resize(names.size() - 1);
+	op_arr_type names_type(INT8, names.size() + 1);
+	op_arr_type offsets_type(INT32, nfiles);
+	vp.init_constant("file_names", const_value(names_type, names, true));
+	vp.init_constant("file_offsets", 
+		const_value(offsets_type, "[" + offsets + "]", true));
+
+	func_attrs attrs;
+	attrs.internal = true;
+	attrs.fn = "noreturn cold";
+	vector<operand> args;
+	args.push_back(operand(i32_type, "file"));
+	args.push_back(operand(i32_type, "line"));
+	vector<op_type> dprintf_types;
+	dprintf_types.push_back(i32_type);
+	dprintf_types.push_back(i8_ptr);
+	dprintf_types.push_back(op_type(VAR_ARG));
+	for (int k = 0; k < NUM_ERROR_STUBS; k++) {
+		string msg = error_stubs[k].msg;
+		op_arr_type msg_type(INT8, msg.size() + 1);
+		string msg_name = string(error_stubs[k].stub) + ".msg";
+		vp.init_constant(msg_name, const_value(msg_type, msg, true));
+
+		reset_fresh_operands();
+		vp.define(op_type(VOID), error_stubs[k].stub, args, attrs);
+		vp.begin_block("entry");
+		operand slot = vp.getelementptr(offsets_type, 
+			global_value(op_arr_ptr_type(INT32, nfiles), "file_offsets"), 
+			int_value(0), args[0], op_type(INT32_PTR));
+		operand name = vp.getelementptr(names_type, 
+			global_value(op_arr_ptr_type(INT8, names.size() + 1), "file_names"), 
+			int_value(0), vp.load(i32_type, slot), i8_ptr);
+		vector<operand> dprintf_args;
+		dprintf_args.push_back(int_value(2));
+		dprintf_args.push_back(vp.getelementptr(msg_type, 
+			global_value(op_arr_ptr_type(INT8, msg.size() + 1), msg_name), 
+			int_value(0), int_value(0), i8_ptr));
+		dprintf_args.push_back(name);
+		dprintf_args.push_back(args[1]);
+		vp.call(dprintf_types, i32_type, "dprintf", true, dprintf_args);
+		vp.call(vector<op_type>(), op_type(VOID), "abort", true, vector<operand>());
+		vp.unreachable();
+		vp.end_define();
+	}
 }
 
 
 #ifdef PA5
+// Each class is generated into its own buffer, on cgen_jobs threads, and
+// the buffers are written out in tree order.  Fresh names restart for
+// every class, so the output does not depend on the schedule.
 void CgenClassTable::code_classes(CgenNode *c)
 {
-	// ADD CODE HERE
+	vector<CgenNode*> order;
+	list_classes(c, order);
+	vector<IRSink*> bufs(order.size());
+	std::atomic<unsigned> next(0);
+
+	auto work = [&]() {
+		for (unsigned i; (i = next++) < order.size(); ) {
+			bufs[i] = new IRSink(4096);
+			ostream s(bufs[i]);
+			reset_fresh_operands();
+			order[i]->code_class(s);
+		}
+	};
+	vector<std::thread> pool;
+	for (int j = 1; j < cgen_jobs && j < (int) order.size(); j++)
+		pool.push_back(std::thread(work));
+	work();
+	for (unsigned j = 0; j < pool.size(); j++)
+		pool[j].join();
+
+	for (unsigned i = 0; i < bufs.size(); i++) {
+		ct_stream->write(bufs[i]->data(), bufs[i]->size());
+		delete bufs[i];
+	}
+}
 
-	c->code_class();
+void CgenClassTable::list_classes(CgenNode *c, vector<CgenNode*> &order)
+{
+	order.push_back(c);
 	List<CgenNode> *children = c->get_children();
-	for (List<CgenNode> *child = children; child; child = child->tl()) {
-		code_classes(child->hd());
+	for (List<CgenNode> *child = children; child; child = child->tl())
+		list_classes(child->hd(), order);
+}
+
+// Returns the access tag of a new TBAA type node
+int CgenClassTable::add_tbaa_node(string name)
+{
+	tbaa_names.push_back(name);
+	return MD_UNLIKELY + 2 * tbaa_names.size();
+}
+
+// Inherited slots keep the tag of the class that declared them, so
+// every access to the same field agrees on its type node
+void CgenClassTable::setup_tbaa(CgenNode *c)
+{
+	for (int i = 0; i < c->get_num_attrs(); i++) {
+		attr_class *a = c->get_attr(i);
+		if (!tbaa_tags.count(a))
+			tbaa_tags[a] = add_tbaa_node(c->get_type_name() + "." + 
+				a->get_name()->get_string());
 	}
+	List<CgenNode> *children = c->get_children();
+	for (List<CgenNode> *child = children; child; child = child->tl())
+		setup_tbaa(child->hd());
 }
+
 #endif
 
 
@@ -584,6 +996,7 @@ void CgenClassTable::code_main()
 	vector<operand> main_args;
 	string main_entry("entry");
 
+#ifndef PA5
 	// to match the lab pt specification
 	string print_format("%d");
 	op_arr_type array_type(INT8, print_format.length()+1);
@@ -596,7 +1009,6 @@ void CgenClassTable::code_main()
 	// Call Main_main(). This returns int* for phase 1, Object for phase 2
 	operand result = vp.call(main_args_types, i32_type, "Main_main", true, main_args);
 
-#ifndef PA5
 	// Get the address of the string "Main_main() returned %d\n" using getelementptr 
 	vector<op_type> printf_args_types;
 	vector<operand> printf_args;
@@ -617,6 +1029,21 @@ void CgenClassTable::code_main()
 
 #else
 	// Phase 2
+	// (new Main).main(), where main may be inherited.  Its result is
+	// dropped; the runtime flushes the output at exit.
+	CgenNode *main_cls = probe(Main);
+	CgenNode *impl = main_cls->lookup_method(main_meth);
+	op_func_type fn = impl->method_type(main_meth);
+	vp.define(i32_type, "main", main_args);
+	vp.begin_block(main_entry);
+	operand obj = vp.call(vector<op_type>(), op_type(main_cls->get_type_name(), 1),
+		main_cls->get_type_name() + "_new", true, vector<operand>());
+	if (impl != main_cls)
+		obj = vp.bitcast(obj, op_type(impl->get_type_name(), 1));
+	vp.call(vector<op_type>(), fn.get_result_type(), 
+		impl->get_type_name() + "_" + main_meth->get_string(), true, 
+		vector<operand>(1, obj), impl->method_cc(main_meth));
+	vp.ret(int_value(0));
 #endif
 	vp.end_define();
 }
@@ -630,9 +1057,13 @@ void CgenClassTable::code_main()
 
 CgenNode::CgenNode(Class_ nd, Basicness bstatus, CgenClassTable *ct)
 : class__class((const class__class &) *nd), 
-  parentnd(0), children(0), basic_status(bstatus), class_table(ct), tag(-1)
+  parentnd(0), children(0), basic_status(bstatus), class_table(ct), tag(-1),
+  instantiated(false), init_reached(false)
 { 
 	// ADD CODE HERE
+#ifdef PA5
+	init_code = false;
+#endif
 }
 
 void CgenNode::add_child(CgenNode *n)
@@ -664,38 +1095,295 @@ void CgenNode::setup(int tag, int depth)
 	layout_features();
 
 	// ADD CODE HERE
-
+	// A new object is a copy of the prototype, which has every default
+	// value and also the constant initializers that come before any
+	// other, since no code can run before them to see the default.
+	// Initializers run ancestors first.
+	proto_attrs = parentnd->proto_attrs;
+	init_code = parentnd->init_code;
+	for (int i = features->first(); features->more(i); i = features->next(i)) {
+		Feature f = features->nth(i);
+		if (f->is_method())
+			continue;
+		attr_class *a = (attr_class *) f;
+		Expression init = a->get_init();
+		Symbol t = a->get_type_decl(), s;
+		int v;
+		bool b;
+		if (init->no_code() || (!init_code && ((t == Int && init->get_int_const(v))
+				|| (t == Bool && init->get_bool_const(b))
+				|| (t == String && init->get_string_const(s)))))
+			proto_attrs.insert(a);
+		else
+			init_code = true;
+	}
 #endif
 }
 
+op_type CgenNode::value_type(Symbol t)
+{
+	if (t == Int || t == prim_int)
+		return op_type(INT32);
+	if (t == Bool || t == prim_bool)
+		return op_type(INT1);
+	if (t == prim_string)
+		return op_type(INT8_PTR);
+	if (t == SELF_TYPE)
+		return op_type(get_type_name(), 1);
+	return op_type(t->get_string(), 1);
+}
+
 #ifdef PA5
 //
 // Class codegen. This should performed after every class has been setup.
 // Generate code for each method of the class.
 //
-void CgenNode::code_class()
+void CgenNode::code_class(std::ostream &s)
 {
 	// No code generation for basic classes. The runtime will handle that.
 	if (basic()) return;
 	
 	// ADD CODE HERE
-	ValuePrinter vp(*get_classtable()->ct_stream);
-	CgenEnvironment *env = new CgenEnvironment(*get_classtable()->ct_stream, this);
-	op_type obj_type(OBJ);
-	vector<operand> method_args;
-
+	// Only a class that has objects needs a vtable
+	if (is_instantiated()) {
+		if (cgen_Memmgr != GC_NOGC)
+			code_vtable(s, code_gc_map(s));
+		else
+			code_vtable(s, null_value(op_type(INT32_PTR)));
+		code_prototype(s);
+		code_new(s);
+		if (needs_init())
+			code_init(s);
+	}
 	for(int i = features->first(); features->more(i); i = features->next(i)){
-		vp.define(obj_type, get_type_name()+"_main", method_args);
-		features->nth(i)->code(env);
-		vp.end_define();
+		Feature f = features->nth(i);
+		// Unreachable methods are not emitted; their vtable slots
+		// point at the shared trap stub instead
+		if (!f->is_method() || !is_method_live(f->get_name()))
+			continue;
+		CgenEnvironment env(s, this);
+		f->code(&env);
 	}
 }
 
+
 // Laying out the features involves creating a Function for each method
 // and assigning each attribute a slot in the class structure.
 void CgenNode::layout_features()
 {
 	// ADD CODE HERE
+	// Parents are set up before their children, so the inherited slots
+	// are already final here
+	vtable_names = parentnd->vtable_names;
+	vtable_impls = parentnd->vtable_impls;
+	attr_slots = parentnd->attr_slots;
+
+	for (int i = features->first(); features->more(i); i = features->next(i))
+		features->nth(i)->layout_feature(this);
+}
+
+// Override the inherited slot of the same name, or append a new one
+void CgenNode::add_method(Symbol m)
+{
+	for (unsigned i = 0; i < vtable_names.size(); i++) {
+		if (vtable_names[i] == m) {
+			vtable_impls[i] = this;
+			return;
+		}
+	}
+	vtable_names.push_back(m);
+	vtable_impls.push_back(this);
+}
+
+// Attributes that no live code reads get no slot at all
+void CgenNode::add_attribute(attr_class *a)
+{
+	if (is_attr_live(a->get_name()))
+		attr_slots.push_back(a);
+}
+
+int CgenNode::get_attr_index(Symbol a)
+{
+	for (unsigned i = 0; i < attr_slots.size(); i++)
+		if (attr_slots[i]->get_name() == a)
+			return i;
+	return -1;
+}
+
+int CgenNode::get_method_index(Symbol m)
+{
+	for (unsigned i = 0; i < vtable_names.size(); i++)
+		if (vtable_names[i] == m)
+			return i;
+	return -1;
+}
+
+// Function type of the definition of method m in this class
+op_func_type CgenNode::method_type(Symbol m)
+{
+	method_class *f = (method_class *) get_feature(m, true);
+	Formals formals = f->get_formals();
+	vector<op_type> args(1, op_type(get_type_name(), 1));
+	for (int i = formals->first(); formals->more(i); i = formals->next(i))
+		args.push_back(value_type(formals->nth(i)->get_type_decl()));
+	return op_func_type(value_type(f->get_return_type()), args);
+}
+
+// A slot has the type of the first definition of its method, so the
+// vtable of a subclass starts with the vtable of its parent
+op_func_type CgenNode::get_slot_type(int i)
+{
+	return method_root(vtable_names[i])->method_type(vtable_names[i]);
+}
+
+// The object is the vtable pointer then the attribute slots, and the
+// vtable is tag, size, name, gc_map and new as in coolrt.h, then the
+// method slots
+void CgenNode::code_types(std::ostream &s)
+{
+	ValuePrinter vp(s);
+	string name = get_type_name();
+	op_type i32_type(INT32);
+	vector<op_type> fields(1, op_type(name + "_vtable", 1));
+	for (int i = 0; i < get_num_attrs(); i++)
+		fields.push_back(get_attr_type(i));
+	// The runtime's String also has its length, hash, offset and rope links
+	if (get_name() == String) {
+		for (int i = 0; i < 3; i++)
+			fields.push_back(i32_type);
+		fields.push_back(op_type(name, 1));
+		fields.push_back(op_type(name, 1));
+	}
+	vp.type_define(name, fields);
+
+	vector<op_type> slots(2, i32_type);
+	slots.push_back(op_type(INT8_PTR));
+	slots.push_back(op_type(INT32_PTR));
+	slots.push_back(op_func_type(op_type(name, 1), vector<op_type>()));
+	for (int i = 0; i < get_num_methods(); i++)
+		slots.push_back(get_slot_type(i));
+	vp.type_define(name + "_vtable", slots);
+
+	// The runtime defines the vtables of the basic classes
+	if (basic())
+		vp.init_ext_constant(name + "_vtable_prototype", 
+			op_type(name + "_vtable"));
+}
+
+// The definitions of this class take a self of this class, and return
+// it for SELF_TYPE, so they are cast to the slot types, as is the stub
+// of a dead method
+void CgenNode::code_vtable(std::ostream &s, const_value gc_map)
+{
+	ValuePrinter vp(s);
+	string name = get_type_name();
+	op_type obj(name), obj_ptr(name, 1), i32_type(INT32);
+	StringEntry *name_str = stringtable.lookup_string(get_name()->get_string());
+	op_func_type new_type(obj_ptr, vector<op_type>());
+
+	vector<op_type> fields(2, i32_type);
+	vector<const_value> init;
+	init.push_back(int_value(tag));
+	init.push_back(const_value(i32_type, "ptrtoint (" + obj_ptr.get_name() 
+		+ " getelementptr (" + obj.get_name() + ", " + obj_ptr.get_name() 
+		+ " null, i32 1) to i32)", true));
+	fields.push_back(op_type(INT8_PTR));
+	init.push_back(const_value(op_arr_type(INT8, name.size() + 1), 
+		"@str." + itos(name_str->get_index()), true));
+	fields.push_back(op_type(INT32_PTR));
+	init.push_back(gc_map);
+	fields.push_back(new_type);
+	init.push_back(const_value(new_type, "@" + name + "_new", true));
+
+	for (int i = 0; i < get_num_methods(); i++) {
+		op_func_type slot = get_slot_type(i);
+		string fn = get_slot_function(i);
+		op_type fn_type = fn == DEAD_METHOD_STUB 
+			? op_func_type(op_type(VOID), vector<op_type>())
+			: vtable_impls[i]->method_type(vtable_names[i]);
+		fields.push_back(slot);
+		if (fn_type.get_name() == slot.get_name())
+			init.push_back(const_value(slot, "@" + fn, true));
+		else
+			init.push_back(casted_value(slot, "@" + fn, fn_type));
+	}
+	vp.init_struct_constant(global_value(op_type(name + "_vtable"), 
+		name + "_vtable_prototype"), fields, init, true);
+}
+
+// Count of the object attributes, then their offsets: the layout of
+// gc_map in the vtables of coolrt.h.  Returns the pointer to it.
+const_value CgenNode::code_gc_map(std::ostream &s)
+{
+	ValuePrinter vp(s);
+	op_type cls(get_type_name());
+	string offsets;
+	int n = 0;
+	for (int i = 0; i < get_num_attrs(); i++) {
+		op_type t = get_attr_type(i);
+		if (t.get_id() != OBJ_PTR)
+			continue;
+		offsets += ", i32 ptrtoint (" + t.get_ptr_type().get_name() 
+			+ " getelementptr (" + cls.get_name() + ", " 
+			+ cls.get_ptr_type().get_name() + " null, i32 0, i32 " 
+			+ itos(i + 1) + ") to i32)";
+		n++;
+	}
+	op_arr_type map_type(INT32, n + 1);
+	vp.init_constant(get_type_name() + "_gc_map", 
+		const_value(map_type, "[i32 " + itos(n) + offsets + "]", true));
+	return const_value(op_type(INT32_PTR), "getelementptr (" + map_type.get_name() 
+		+ ", " + map_type.get_ptr_type().get_name() + " @" + get_type_name() 
+		+ "_gc_map, i32 0, i32 0)", true);
+}
+
+// The vtable pointer, then for each attribute its constant initializer
+// if that is in the prototype, else the default: 0, false, "" or void
+void CgenNode::code_prototype(std::ostream &s)
+{
+	ValuePrinter vp(s);
+	op_type vtbl_ptr(get_type_name() + "_vtable", 1);
+	vector<op_type> fields(1, vtbl_ptr);
+	vector<const_value> init(1, const_value(vtbl_ptr, 
+		"@" + get_type_name() + "_vtable_prototype", true));
+	for (int i = 0; i < get_num_attrs(); i++) {
+		op_type t = get_attr_type(i);
+		bool folded = in_prototype(get_attr(i));
+		Expression e = get_attr(i)->get_init();
+		int v = 0;
+		bool b = false;
+		Symbol str;
+		fields.push_back(t);
+		if (t.get_id() == INT32) {
+			if (folded)
+				e->get_int_const(v);
+			init.push_back(int_value(v));
+		}
+		else if (t.get_id() == INT1) {
+			if (folded)
+				e->get_bool_const(b);
+			init.push_back(bool_value(b, true));
+		}
+		else if (t.is_string_object()) {
+			StringEntry *entry = folded && e->get_string_const(str) 
+				? (StringEntry *) str : stringtable.lookup_string("");
+			init.push_back(const_value(t, "@String." + itos(entry->get_index()),
+				true));
+		}
+		else
+			init.push_back(null_value(t));
+	}
+	vp.init_struct_constant(global_value(op_type(get_type_name()), 
+		get_type_name() + "_prototype"), fields, init, true);
+}
+
+
+string CgenNode::get_slot_function(int i)
+{
+	CgenNode *impl = vtable_impls[i];
+	if (!impl->is_method_live(vtable_names[i]))
+		return DEAD_METHOD_STUB;
+	return impl->get_type_name() + "_" + vtable_names[i]->get_string();
 }
 #else
 
@@ -737,12 +1425,14 @@ void CgenNode::codeGenMainmain()
 // constructor.
 //
 CgenEnvironment::CgenEnvironment(std::ostream &o, CgenNode *c)
+: frame_buf(256), body_buf(4096), frame(&frame_buf), body(&body_buf)
 {
 	cur_class = c;
 	cur_stream = &o;
 	var_table.enterscope();
 	tmp_count = block_count = ok_count = 0;
 	// ADD CODE HERE
+	may_tail = false;
 }
 
 // Look up a CgenNode given a symbol
@@ -780,380 +1470,2812 @@ void CgenEnvironment::kill_local() {
 	var_table.exitscope();
 }
 
+void CgenEnvironment::begin_object(CgenNode *c, operand &self_slot) {
+	outer_vars.push_back(var_table);
+	outer_classes.push_back(cur_class);
+	var_table = cool::SymbolTable<Symbol,operand>();
+	var_table.enterscope();
+	var_table.addid(self, &self_slot);
+	cur_class = c;
+}
 
-////////////////////////////////////////////////////////////////////////////
-//
-// APS class methods
-//
-////////////////////////////////////////////////////////////////////////////
+void CgenEnvironment::end_object() {
+	var_table.exitscope();
+	var_table = outer_vars.back();
+	outer_vars.pop_back();
+	cur_class = outer_classes.back();
+	outer_classes.pop_back();
+}
 
-//******************************************************************
-//
-//   Fill in the following methods to produce code for the
-//   appropriate expression.  You may add or remove parameters
-//   as you wish, but if you do, remember to change the parameters
-//   of the declarations in `cool-tree.handcode.h'.
-//
-//*****************************************************************
+void CgenEnvironment::open_frame() {
+	method_stream = cur_stream;
+	cur_stream = &body;
+}
 
-#ifdef PA5
-// conform and get_class_tag are only needed for PA5
+void CgenEnvironment::close_frame() {
+	cur_stream = method_stream;
+	cur_stream->write(frame_buf.data(), frame_buf.size());
+	cur_stream->write(body_buf.data(), body_buf.size());
+}
 
-// conform - If necessary, emit a bitcast or boxing/unboxing operations
-// to convert an object to a new type. This can assume the object
-// is known to be (dynamically) compatible with the target type.
-// It should only be called when this condition holds.
-// (It's needed by the supplied code for typecase)
-operand conform(operand src, op_type type, CgenEnvironment *env) {
-	// ADD CODE HERE (PA5 ONLY)
-	return operand();
+// A slot for a value of the given type, in the entry block
+operand CgenEnvironment::alloc_slot(op_type type) {
+	vector<operand> &reuse = free_slots[type.get_name()];
+	if (!reuse.empty()) {
+		operand slot = reuse.back();
+		reuse.pop_back();
+		return slot;
+	}
+	ValuePrinter vp(frame);
+	operand slot = vp.alloca_mem(type);
+	// An object slot is a root, and must not hold garbage when the
+	// first collection looks at it
+	if (cgen_Memmgr != GC_NOGC && type.get_id() == OBJ_PTR) {
+		vector<operand> args(1, vp.bitcast(slot, op_type(INT8_PPTR)));
+		args.push_back(null_value(op_type(INT8_PTR)));
+		vp.call(vector<op_type>(), op_type(VOID), "llvm.gcroot", true, args);
+		vp.store(null_value(type), slot);
+	}
+	return slot;
 }
 
-// Retrieve the class tag from an object record.
-// src is the object we need the tag from.
-// src_class is the CgenNode for the *static* class of the expression.
-// You need to look up and return the class tag for it's dynamic value
-operand get_class_tag(operand src, CgenNode *src_cls, CgenEnvironment *env) {
-	// ADD CODE HERE (PA5 ONLY)
-	return operand();
+// The scope of the slot has ended
+void CgenEnvironment::free_slot(operand slot) {
+	free_slots[slot.get_type().get_deref_type().get_name()].push_back(slot);
 }
-#endif
 
-//
-// Create a method body
-// 
-void method_class::code(CgenEnvironment *env)
-{
-	if (cgen_debug) std::cerr << "method" << endl;
-	ValuePrinter vp(*env->cur_stream);
+operand CgenEnvironment::spill(operand v) {
+	if (cgen_Memmgr == GC_NOGC || v.get_type().get_id() != OBJ_PTR)
+		return v;
+	ValuePrinter vp(*cur_stream);
+	operand slot = alloc_slot(v.get_type());
+	vp.store(v, slot);
+	return slot;
+}
 
-	vp.ret(expr->code(env));
+operand CgenEnvironment::unspill(operand v) {
+	if (v.get_type().get_id() != OBJ_PPTR)
+		return v;
+	ValuePrinter vp(*cur_stream);
+	free_slot(v);
+	return vp.load(v.get_type().get_deref_type(), v);
 }
 
+
+///////////////////////////////////////////////////////////////////////
 //
-// Codegen for expressions.  Note that each expression has a value.
+// Reachability from Main.main
 //
+// Before layout, the class table walks every method that can run,
+// starting at Main.main and the initializers of Main.  The walk records
+// which classes are ever instantiated; a dispatch on static class T
+// reaches the definition of the method visible in each instantiated
+// subclass of T (RTA).  Methods never reached are not emitted, and
+// attributes never read get no slot in the object layout.
+//
+///////////////////////////////////////////////////////////////////////
 
-operand assign_class::code(CgenEnvironment *env) 
-{ 
-	if (cgen_debug) std::cerr << "assign" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	operand new_value = expr->code(env);
-	operand var = *env->lookup(name);
-
-	vp.store(new_value, var);
-	return new_value;
+Feature CgenNode::get_feature(Symbol name, bool method)
+{
+	for (int i = features->first(); features->more(i); i = features->next(i)) {
+		Feature f = features->nth(i);
+		if (f->get_name() == name && (f->is_method() != 0) == method)
+			return f;
+	}
+	return NULL;
 }
 
-operand cond_class::code(CgenEnvironment *env) 
-{ 
-	if (cgen_debug) std::cerr << "cond" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	string then_br = env->new_label("cond.", true);
-	string else_br = env->new_label("cond.", true);
-	string end_br = env->new_label("cond.", true);
-	//FIXME, any other way to get the type without running the code?
-	operand merge = vp.alloca_mem(then_exp->code(env).get_type());
+CgenNode *CgenNode::lookup_method(Symbol name)
+{
+	for (CgenNode *c = this; c && c->get_name() != No_class; c = c->parentnd)
+		if (c->get_feature(name, true))
+			return c;
+	return NULL;
+}
 
-	operand pred_operand = pred->code(env);
+CgenNode *CgenNode::lookup_attr(Symbol name)
+{
+	for (CgenNode *c = this; c && c->get_name() != No_class; c = c->parentnd)
+		if (c->get_feature(name, false))
+			return c;
+	return NULL;
+}
 
-	vp.branch_cond(pred_operand, then_br, else_br);
+bool CgenNode::is_subclass_of(CgenNode *c)
+{
+	for (CgenNode *p = this; p; p = p->parentnd)
+		if (p == c)
+			return true;
+	return false;
+}
 
-	vp.begin_block(then_br);
-	operand then_operand = then_exp->code(env);
-	vp.store(then_operand, merge);
-	vp.branch_uncond(end_br);
+bool CgenNode::has_live_override(Symbol m)
+{
+	for (List<CgenNode> *l = children; l; l = l->tl()) {
+		CgenNode *c = l->hd();
+		if ((c->get_feature(m, true) && c->is_method_live(m)) 
+		    || c->has_live_override(m))
+			return true;
+	}
+	return false;
+}
 
-	vp.begin_block(else_br);
-	operand else_operand = else_exp->code(env);
-	vp.store(else_operand, merge);
-	vp.branch_uncond(end_br);
+// Cool methods call each other with fastcc, so that llc can turn tail
+// calls into jumps.  A method sharing a vtable slot with a runtime
+// method, and Main.main which the entry point calls, keep the C
+// convention.
+CgenNode *CgenNode::method_root(Symbol m)
+{
+	CgenNode *root = lookup_method(m);
+	while (CgenNode *up = root->parentnd->lookup_method(m))
+		root = up;
+	return root;
+}
 
-	vp.begin_block(end_br);
+call_conv CgenNode::method_cc(Symbol m)
+{
+	CgenNode *root = method_root(m);
+	if (root->basic())
+		return CCC;
+	if (m == main_meth && class_table->lookup(Main)->is_subclass_of(root))
+		return CCC;
+	return FASTCC;
+}
 
-	return vp.load(else_operand.get_type(), merge);
+void CgenClassTable::compute_reachability()
+{
+	// The runtime creates Int, Bool and String objects on its own,
+	// and code_main creates the Main object
+	reach_instantiate(probe(Int));
+	reach_instantiate(probe(Bool));
+	reach_instantiate(probe(String));
+	reach_instantiate(probe(Main));
+	reach_method(probe(Main), idtable.add_string("main"));
+
+	while (!reach_worklist.empty()) {
+		std::pair<CgenNode*,Feature> m = reach_worklist.back();
+		reach_worklist.pop_back();
+		ReachEnvironment env(m.first);
+		m.second->reach(&env);
+	}
 }
 
-operand loop_class::code(CgenEnvironment *env) 
-{ 
-	if (cgen_debug) std::cerr << "loop" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	string loop_br = env->new_label("loop.", true);
-	string body_br = env->new_label("loop.", true);
-	string end_br = env->new_label("loop.", true);
+// A class becomes instantiated: its initializers (and those of its
+// ancestors) run, and every dispatch site seen so far may now reach it
+void CgenClassTable::reach_instantiate(CgenNode *c)
+{
+	if (c->is_instantiated())
+		return;
+	c->set_instantiated();
+	reach_classes.push_back(c);
+
+	for (CgenNode *p = c; p->get_name() != No_class; p = p->get_parentnd()) {
+		if (p->is_init_reached() || p->basic())
+			continue;
+		p->set_init_reached();
+		Features fs = p->get_features();
+		for (int i = fs->first(); fs->more(i); i = fs->next(i)) {
+			if (fs->nth(i)->is_method())
+				continue;
+			ReachEnvironment env(p);
+			fs->nth(i)->reach(&env);
+		}
+	}
 
-	vp.branch_uncond(loop_br);
-	vp.begin_block(loop_br);
-	operand pred_operand = pred->code(env);
-	vp.branch_cond(pred_operand, body_br, end_br);
+	std::set<std::pair<CgenNode*,Symbol> >::iterator site;
+	for (site = reach_sites.begin(); site != reach_sites.end(); ++site)
+		if (c->is_subclass_of(site->first))
+			reach_method(c, site->second);
+}
 
-	vp.begin_block(body_br);
-	operand body_operand = body->code(env);
-	vp.branch_uncond(loop_br);
+void CgenClassTable::reach_dispatch(CgenNode *static_cls, Symbol name)
+{
+	if (!reach_sites.insert(std::make_pair(static_cls, name)).second)
+		return;
+	for (unsigned i = 0; i < reach_classes.size(); i++)
+		if (reach_classes[i]->is_subclass_of(static_cls))
+			reach_method(reach_classes[i], name);
+}
 
-	vp.begin_block(end_br);
-	return body_operand;
-} 
+// Mark the definition of name visible in class c as live
+void CgenClassTable::reach_method(CgenNode *c, Symbol name)
+{
+	CgenNode *impl = c->lookup_method(name);
+	assert(impl && "dispatch to undefined method");
+	if (!impl->mark_method_live(name) || impl->basic())
+		return;
+	reach_worklist.push_back(std::make_pair(impl, impl->get_feature(name, true)));
+}
 
-operand block_class::code(CgenEnvironment *env) 
-{ 
-	if (cgen_debug) std::cerr << "block" << endl;
-	operand last_operand;
-	for(int i = body->first(); body->more(i); i = body->next(i)){
-		last_operand = body->nth(i)->code(env);
+#ifdef PA5
+void CgenClassTable::report_removed_features(CgenNode *c)
+{
+	for (List<CgenNode> *l = c->get_children(); l; l = l->tl())
+		report_removed_features(l->hd());
+	if (c->basic())
+		return;
+	if (!c->is_instantiated())
+		std::cerr << "Class " << c->get_name() << " is never instantiated" << endl;
+	Features fs = c->get_features();
+	for (int i = fs->first(); fs->more(i); i = fs->next(i)) {
+		Feature f = fs->nth(i);
+		if (f->is_method() && !c->is_method_live(f->get_name())) {
+			std::cerr << "Removed method " << c->get_name() << "." 
+				<< f->get_name() << endl;
+			removed_methods++;
+		}
+		if (!f->is_method() && !c->is_attr_live(f->get_name())) {
+			std::cerr << "Removed attribute " << c->get_name() << "." 
+				<< f->get_name() << endl;
+			removed_attrs++;
+		}
 	}
-	return last_operand;
 }
 
-operand let_class::code(CgenEnvironment *env) 
-{ 
-	if (cgen_debug) std::cerr << "let" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	op_type var_type;
-	string type_str(type_decl->get_string());
+// void dead_method() { abort(); }
+// Every vtable slot of an unreachable method is filled with this stub
+// (bitcast to the slot type), so a wrong analysis fails loudly.
+void CgenClassTable::code_dead_method_stub()
+{
+	ValuePrinter vp(*ct_stream);
+	op_type void_type(VOID);
+	vector<operand> args;
+	vector<op_type> arg_types;
+
+	func_attrs attrs;
+	attrs.internal = true;
+	attrs.fn = "noreturn cold";
+	vp.define(void_type, DEAD_METHOD_STUB, args, attrs);
+	vp.begin_block("entry");
+	vp.call(arg_types, void_type, "abort", true, vector<operand>());
+	vp.unreachable();
+	vp.end_define();
+}
 
-	if(type_str.compare("Bool") == 0) var_type = INT1;
-	else var_type = INT32;
+// The bump-pointer fast path of cool_alloc in coolrt.h, inlined into
+// every allocation.  Object sizes are already multiples of 8.
+void CgenClassTable::code_heap_alloc()
+{
+	ValuePrinter vp(*ct_stream);
+	op_type i8_type(INT8), i8_ptr(INT8_PTR), i8_pptr(INT8_PPTR), i32_type(INT32);
+	// Defining cool_gc_flags turns on the runtime's collector, with the
+	// -t and -T modes, or its semispace collector
+	if (cgen_Memmgr != GC_NOGC) {
+		int flags = GC_FLAG_ENABLED 
+			| (cgen_Memmgr == GC_SNCGC ? GC_FLAG_SEMISPACE : 0)
+			| (cgen_Memmgr_Test == GC_TEST ? GC_FLAG_TEST : 0)
+			| (cgen_Memmgr_Debug == GC_DEBUG ? GC_FLAG_DEBUG : 0);
+		vp.init_constant("cool_gc_flags", const_value(i32_type, itos(flags), false));
+	}
+	operand size(i32_type, "size");
+	func_attrs attrs;
+	attrs.internal = true;
+	attrs.ret = "noalias nonnull";
+	attrs.fn = "alwaysinline";
+	vp.define(i8_ptr, HEAP_ALLOC, vector<operand>(1, size), attrs);
+	vp.begin_block("entry");
+	global_value heap_ptr(i8_pptr, "cool_heap_ptr"), heap_limit(i8_pptr, "cool_heap_limit");
+	operand p = vp.load(i8_ptr, heap_ptr);
+	operand end = vp.getelementptr(i8_type, p, size, i8_ptr);
+	operand full = vp.icmp(UGT, end, vp.load(i8_ptr, heap_limit));
+	vp.branch_cond(full, "slow", "fast", MD_UNLIKELY);
+	vp.begin_block("fast");
+	vp.store(end, heap_ptr);
+	vp.ret(p);
+	vp.begin_block("slow");
+	vp.ret(vp.call(vector<op_type>(1, i32_type), i8_ptr, "cool_alloc_slow", true,
+		vector<operand>(1, size)));
+	vp.end_define();
+}
+#endif
 
-	operand var_alloca = vp.alloca_mem(var_type);
-	env->add_local(identifier, var_alloca);
+ReachEnvironment::ReachEnvironment(CgenNode *c) : cur_class(c)
+{
+	locals.enterscope();
+}
+
+CgenNode *ReachEnvironment::type_to_class(Symbol t)
+{
+	return t == SELF_TYPE ? cur_class
+		: cur_class->get_classtable()->lookup(t);
+}
+
+void ReachEnvironment::add_local(Symbol name, Symbol type_decl)
+{
+	locals.enterscope();
+	locals.addid(name, type_decl);
+}
+
+void ReachEnvironment::kill_local()
+{
+	locals.exitscope();
+}
+
+// new SELF_TYPE may create any subclass of the current class
+void ReachEnvironment::instantiate(Symbol type)
+{
+	CgenClassTable *ct = cur_class->get_classtable();
+	if (type != SELF_TYPE) {
+		ct->reach_instantiate(type_to_class(type));
+		return;
+	}
+	vector<CgenNode*> todo(1, cur_class);
+	while (!todo.empty()) {
+		CgenNode *c = todo.back();
+		todo.pop_back();
+		ct->reach_instantiate(c);
+		for (List<CgenNode> *l = c->get_children(); l; l = l->tl())
+			todo.push_back(l->hd());
+	}
+}
+
+void ReachEnvironment::dispatch(Symbol static_type, Symbol name)
+{
+	cur_class->get_classtable()->reach_dispatch(type_to_class(static_type), name);
+}
+
+void ReachEnvironment::static_dispatch(Symbol type, Symbol name)
+{
+	cur_class->get_classtable()->reach_method(type_to_class(type), name);
+}
+
+// A name that is neither self nor bound locally is an attribute
+void ReachEnvironment::read(Symbol name)
+{
+	if (name == self || locals.lookup(name))
+		return;
+	CgenNode *owner = cur_class->lookup_attr(name);
+	assert(owner && "reference to undefined attribute");
+	owner->mark_attr_read(name);
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Escape analysis
+//
+// Runs after reachability.  Every live method is analyzed with the
+// current summaries of its callees; the passes repeat until no summary
+// changes, starting from the optimistic "nothing escapes" summary so that
+// recursion converges to the least fixed point.  An allocation of a user
+// class whose object does not escape, whose initializers do not leak
+// self, and which is not inside a loop is given a stack slot by
+// new__class::code.
+//
+///////////////////////////////////////////////////////////////////////
+
+void CgenClassTable::compute_escapes()
+{
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		stack_sites.clear();
+		frame_methods.clear();
+		num_alloc_sites = 0;
+		// Parents first, so escaping initializers propagate down
+		vector<CgenNode*> todo(1, root());
+		while (!todo.empty()) {
+			CgenNode *c = todo.back();
+			todo.pop_back();
+			changed |= escape_pass(c);
+			for (List<CgenNode> *l = c->get_children(); l; l = l->tl())
+				todo.push_back(l->hd());
+		}
+	}
+}
+
+// Analyze the initializers and live methods of one class, returning
+// true if any summary changed
+bool CgenClassTable::escape_pass(CgenNode *c)
+{
+	if (c->basic())
+		return false;
+	bool changed = false;
+	Features fs = c->get_features();
+
+	EscapeEnvironment init_env(c, c);
+	for (int i = fs->first(); fs->more(i); i = fs->next(i))
+		if (!fs->nth(i)->is_method())
+			fs->nth(i)->escape(&init_env);
+	if ((init_env.self_escaped() || init_leaks_self(c->get_parentnd()))
+	    && escaping_inits.insert(c).second)
+		changed = true;
+
+	for (int i = fs->first(); fs->more(i); i = fs->next(i)) {
+		Feature f = fs->nth(i);
+		if (!f->is_method() || !c->is_method_live(f->get_name()))
+			continue;
+		EscapeEnvironment env(c, f);
+		f->escape(&env);
+		EscapeSummary &old = escape_summaries[f];
+		if (!(old == env.summary)) {
+			old = env.summary;
+			changed = true;
+		}
+
+		// A method whose self tail calls become a loop runs all of its
+		// allocation sites repeatedly
+		bool loops = ((method_class *) f)->has_self_tail_call(c);
+		for (unsigned j = 0; j < env.sites.size(); j++) {
+			new__class *site = env.sites[j];
+			num_alloc_sites++;
+			if (!env.has_escaped(site) && !env.loop_sites.count(site) && !loops
+			    && !init_leaks_self(lookup(site->get_type_name()))) {
+				stack_sites.insert(site);
+				frame_methods.insert(f);
+			}
+		}
+	}
+	return changed;
+}
+
+EscapeSummary CgenClassTable::get_escape_summary(CgenNode *c, Symbol name)
+{
+	CgenNode *impl = c->lookup_method(name);
+	method_class *m = (method_class *) impl->get_feature(name, true);
+	if (!impl->basic())
+		return escape_summaries[m];
+
+	// Runtime methods keep no references; the IO methods return self
+	EscapeSummary s;
+	s.returns_self = m->get_return_type() == SELF_TYPE && name != cool_copy;
+	return s;
+}
+
+EscapeEnvironment::EscapeEnvironment(CgenNode *c, tree_node *self_tok)
+: cur_class(c), self_token(self_tok), loop_depth(0)
+{
+	locals.enterscope();
+}
+
+CgenNode *EscapeEnvironment::type_to_class(Symbol t)
+{
+	return t == SELF_TYPE ? cur_class
+		: cur_class->get_classtable()->lookup(t);
+}
+
+void EscapeEnvironment::add_local(Symbol name, tree_node *binding, EscapeSet init)
+{
+	locals.enterscope();
+	locals.addid(name, binding);
+	stored[binding].insert(init.begin(), init.end());
+}
+
+void EscapeEnvironment::kill_local()
+{
+	locals.exitscope();
+}
+
+// Attributes hold nothing allocated by this method that has not
+// already escaped, so reading one yields the empty set
+EscapeSet EscapeEnvironment::lookup(Symbol name)
+{
+	EscapeSet v;
+	if (name == self)
+		v.insert(self_token);
+	else if (tree_node *binding = locals.lookup(name))
+		v.insert(binding);
+	return v;
+}
+
+void EscapeEnvironment::assign(Symbol name, EscapeSet v)
+{
+	if (tree_node *binding = locals.lookup(name))
+		stored[binding].insert(v.begin(), v.end());
+	else
+		escape(v);
+}
+
+EscapeSet EscapeEnvironment::alloc(new__class *site)
+{
+	sites.push_back(site);
+	if (loop_depth > 0)
+		loop_sites.insert(site);
+	EscapeSet v;
+	v.insert(site);
+	return v;
+}
+
+// Everything v may refer to, following what was stored into locals
+EscapeSet EscapeEnvironment::closure(EscapeSet v)
+{
+	vector<tree_node*> todo(v.begin(), v.end());
+	while (!todo.empty()) {
+		tree_node *t = todo.back();
+		todo.pop_back();
+		std::map<tree_node*,EscapeSet>::iterator it = stored.find(t);
+		if (it == stored.end())
+			continue;
+		for (EscapeSet::iterator j = it->second.begin(); j != it->second.end(); ++j)
+			if (v.insert(*j).second)
+				todo.push_back(*j);
+	}
+	return v;
+}
+
+EscapeSet EscapeEnvironment::dispatch(CgenNode *static_cls, Symbol name, 
+	bool is_static, EscapeSet recv, vector<EscapeSet> &args)
+{
+	CgenClassTable *ct = cur_class->get_classtable();
+	std::set<CgenNode*> targets;
+	if (is_static)
+		targets.insert(static_cls->lookup_method(name));
+	else {
+		vector<CgenNode*> todo(1, static_cls);
+		while (!todo.empty()) {
+			CgenNode *c = todo.back();
+			todo.pop_back();
+			if (c->is_instantiated())
+				targets.insert(c->lookup_method(name));
+			for (List<CgenNode> *l = c->get_children(); l; l = l->tl())
+				todo.push_back(l->hd());
+		}
+	}
+
+	EscapeSet result;
+	std::set<CgenNode*>::iterator t;
+	for (t = targets.begin(); t != targets.end(); ++t) {
+		EscapeSummary s = ct->get_escape_summary(*t, name);
+		if (s.self_escapes)
+			escape(recv);
+		if (s.returns_self)
+			result.insert(recv.begin(), recv.end());
+		for (unsigned i = 0; i < args.size(); i++) {
+			if (i < s.param_escapes.size() && s.param_escapes[i])
+				escape(args[i]);
+			if (i < s.returns_param.size() && s.returns_param[i])
+				result.insert(args[i].begin(), args[i].end());
+		}
+	}
+	return result;
+}
+
+void EscapeEnvironment::summarize(EscapeSet ret, vector<tree_node*> &formals)
+{
+	EscapeSet esc = closure(escaped);
+	EscapeSet out = closure(ret);
+	summary.self_escapes = esc.count(self_token) != 0;
+	summary.returns_self = out.count(self_token) != 0;
+	for (unsigned i = 0; i < formals.size(); i++) {
+		summary.param_escapes.push_back(esc.count(formals[i]) != 0);
+		summary.returns_param.push_back(out.count(formals[i]) != 0);
+	}
+	// The caller gets the returned objects, so they outlive the method
+	escape(ret);
+}
+
+bool EscapeEnvironment::has_escaped(new__class *site)
+{
+	return closure(escaped).count(site) != 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//
+// Constant folding and simplification
+//
+////////////////////////////////////////////////////////////////////////////
+
+void CgenClassTable::simplify_classes(CgenNode *c, SimplifyEnvironment *env)
+{
+	for (List<CgenNode> *l = c->get_children(); l; l = l->tl())
+		simplify_classes(l->hd(), env);
+	if (c->basic())
+		return;
+	Features fs = c->get_features();
+	for (int i = fs->first(); fs->more(i); i = fs->next(i))
+		fs->nth(i)->simplify(env);
+}
+
+SimplifyEnvironment::SimplifyEnvironment()
+: propagate(false), num_simplified(0)
+{
+	consts.enterscope();
+}
+
+void SimplifyEnvironment::add_local(Symbol name, Expression value)
+{
+	consts.enterscope();
+	consts.addid(name, value);
+}
+
+void SimplifyEnvironment::kill_local()
+{
+	consts.exitscope();
+}
+
+// Fresh constant nodes take the position of the expression they replace
+static Expression make_int(int v, tree_node *at)
+{
+	Expression e = int_const(inttable.add_int(v));
+	e->set(at);
+	e->set_type(Int);
+	return e;
+}
+
+static Expression make_bool(bool b, tree_node *at)
+{
+	Expression e = bool_const(b);
+	e->set(at);
+	e->set_type(Bool);
+	return e;
+}
+
+// e standing in for an expression of static type t.  A narrower e is
+// wrapped in a block of type t, which conforms its value to t.
+static Expression with_type(Expression e, Symbol t, tree_node *at)
+{
+	if (e->get_type() == t)
+		return e;
+	Expression b = block(single_Expressions(e));
+	b->set(at);
+	b->set_type(t);
+	return b;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//
+// APS class methods
+//
+////////////////////////////////////////////////////////////////////////////
+
+//******************************************************************
+//
+//   Fill in the following methods to produce code for the
+//   appropriate expression.  You may add or remove parameters
+//   as you wish, but if you do, remember to change the parameters
+//   of the declarations in `cool-tree.handcode.h'.
+//
+//*****************************************************************
+
+// A runtime error check branches, as an unlikely branch, to a block of
+// its own that calls the shared stub for its kind of error
+static void code_error_block(label err, error_kind kind, int line, 
+	CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	CgenNode *cls = env->get_class();
+	vector<operand> args;
+	args.push_back(int_value(cls->get_classtable()->get_file_index(
+		cls->get_filename())));
+	args.push_back(int_value(line));
+	vp.begin_block(err);
+	vp.call(vector<op_type>(), op_type(VOID), error_stubs[kind].stub, true, args);
+	vp.unreachable();
+}
+
+// Code continues in a fresh block where cond is false
+static void code_error_check(operand cond, error_kind kind, int line, 
+	CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	string err = env->new_label("error.", true);
+	string ok = env->new_ok_label();
+	vp.branch_cond(cond, err, ok, MD_UNLIKELY);
+	code_error_block(err, kind, line, env);
+	vp.begin_block(ok);
+}
+
+#ifdef PA5
+// conform and get_class_tag are only needed for PA5
+
+// conform - If necessary, emit a bitcast or boxing/unboxing operations
+// to convert an object to a new type. This can assume the object
+// is known to be (dynamically) compatible with the target type.
+// It should only be called when this condition holds.
+// (It's needed by the supplied code for typecase)
+//
+// Int and Bool values are never boxed while their static type is Int or
+// Bool, so this is the only place a box is created (when the value flows
+// into Object, IO, SELF_TYPE, ...) or opened (when a typcase branch or a
+// dispatch result of type Int/Bool receives an object).  Boxes have the
+// layout { vtable*, val }.
+//
+// The size of an object of the given class type, folded to a constant
+// by LLVM
+static operand code_sizeof(op_type obj_type, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	op_type ptr_type = obj_type.get_ptr_type();
+	operand end = vp.getelementptr(obj_type, null_value(ptr_type), 
+		int_value(1), ptr_type);
+	return vp.ptrtoint(end, op_type(INT32));
+}
+
+// Allocate size bytes on the runtime heap
+static operand code_alloc(operand size, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	return vp.call(vector<op_type>(1, op_type(INT32)), op_type(INT8_PTR), 
+		HEAP_ALLOC, true, vector<operand>(1, size));
+}
+
+// Allocate an object of the given class type on the runtime heap
+static operand code_alloc(op_type obj_type, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	return vp.bitcast(code_alloc(code_sizeof(obj_type, env), env), 
+		obj_type.get_ptr_type());
+}
+
+static void code_memcpy(operand to, operand from, operand size, 
+	CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	op_type i8_ptr(INT8_PTR);
+	vector<operand> args;
+	args.push_back(to.get_type().is_same_with(i8_ptr) ? to : vp.bitcast(to, i8_ptr));
+	args.push_back(vp.bitcast(from, i8_ptr));
+	args.push_back(size);
+	args.push_back(bool_value(false, true));
+	vp.call(vector<op_type>(), op_type(VOID), "llvm.memcpy.p0i8.p0i8.i32", true, 
+		args);
+}
+
+static void code_init_attrs(CgenNode *cls, CgenEnvironment *env);
+
+// A new object of a class defined in the program: a copy of its
+// prototype, on the heap or in a stack slot, then the initializers that
+// are not in the prototype.  Those of a heap object are in _init; those
+// of a stack object are generated inline, as the object cannot move.
+static operand code_new_object(CgenNode *cls, bool on_stack, 
+	CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	string name = cls->get_type_name();
+	op_type obj_type(name);
+	operand size = code_sizeof(obj_type, env);
+	operand obj = on_stack ? env->alloc_slot(obj_type) 
+		: vp.bitcast(code_alloc(size, env), obj_type.get_ptr_type());
+	code_memcpy(obj, global_value(obj_type.get_ptr_type(), name + "_prototype"),
+		size, env);
+	if (on_stack && cls->needs_init()) {
+		operand self_slot = env->alloc_slot(obj.get_type());
+		vp.store(obj, self_slot);
+		env->begin_object(cls, self_slot);
+		code_init_attrs(cls, env);
+		env->end_object();
+		env->free_slot(self_slot);
+	}
+	else if (cls->needs_init()) {
+		// The initializers may allocate and move the object
+		operand saved = env->spill(obj);
+		vp.call(vector<op_type>(), op_type(VOID), name + "_init", true, 
+			vector<operand>(1, obj));
+		obj = env->unspill(saved);
+	}
+	return obj;
+}
+
+// Run the initializers of cls and of its ancestors, ancestors first, on
+// the object in self.  Those in the prototype are skipped.
+static void code_init_attrs(CgenNode *cls, CgenEnvironment *env)
+{
+	if (cls->basic())
+		return;
+	code_init_attrs(cls->get_parentnd(), env);
+	Features fs = cls->get_features();
+	for (int i = fs->first(); fs->more(i); i = fs->next(i))
+		if (!fs->nth(i)->is_method())
+			fs->nth(i)->code(env);
+}
+
+// _init runs on a copy of the prototype of exactly this class, so the
+// initializers of the ancestors are generated for this class too
+void CgenNode::code_init(std::ostream &s)
+{
+	ValuePrinter vp(s);
+	CgenEnvironment env(s, this);
+	operand self_arg(op_type(get_type_name(), 1), "self");
+	func_attrs attrs;
+	attrs.internal = true;
+	attrs.params.push_back("nonnull dereferenceable(8)");
+	if (cgen_Memmgr != GC_NOGC)
+		attrs.gc = "shadow-stack";
+	vp.define(op_type(VOID), get_type_name() + "_init", 
+		vector<operand>(1, self_arg), attrs);
+	vp.begin_block("entry");
+	env.open_frame();
+	ValuePrinter body(*env.cur_stream);
+	operand self_slot = env.alloc_slot(self_arg.get_type());
+	body.store(self_arg, self_slot);
+	env.add_local(self, self_slot);
+	code_init_attrs(this, &env);
+	body.ret(const_value(op_type(VOID), "", true));
+	env.close_frame();
+	vp.end_define();
+	env.kill_local();
+}
+
+// The function in the new slot of the vtable, for new SELF_TYPE
+void CgenNode::code_new(std::ostream &s)
+{
+	ValuePrinter vp(s);
+	CgenEnvironment env(s, this);
+	op_type obj_ptr(get_type_name(), 1);
+	func_attrs attrs;
+	attrs.internal = true;
+	attrs.ret = "nonnull";
+	if (cgen_Memmgr != GC_NOGC)
+		attrs.gc = "shadow-stack";
+	vp.define(obj_ptr, get_type_name() + "_new", vector<operand>(), attrs);
+	vp.begin_block("entry");
+	env.open_frame();
+	ValuePrinter body(*env.cur_stream);
+	body.ret(code_new_object(this, false, &env));
+	env.close_frame();
+	vp.end_define();
+}
+
+static int box_val_tbaa(Symbol box_class, CgenEnvironment *env)
+{
+	CgenNode *box = env->get_class()->get_classtable()->lookup(box_class);
+	return box->get_attr_tbaa(BOX_VAL_FIELD - 1);
+}
+
+// A new Int/Bool box holding src, with its vtable set.  Like the
+// prototype memcpy, this is the only write of the vtable pointer.
+static operand code_box_alloc(operand src, Symbol box_class, 
+	CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	string cls = box_class->get_string();
+	op_type box_type(cls, 1);
+	op_type vtbl_ptr(cls + "_vtable", 1);
+	operand box = code_alloc(box_type.get_deref_type(), env);
+	operand vtbl_slot = vp.getelementptr(box_type.get_deref_type(), box, 
+		int_value(0), int_value(0), vtbl_ptr.get_ptr_type());
+	vp.store(global_value(vtbl_ptr, cls + "_vtable_prototype"), vtbl_slot,
+		access_md(env->get_class()->get_classtable()->vtable_ptr_tbaa));
+	operand field = vp.getelementptr(box_type.get_deref_type(), box, 
+		int_value(0), int_value(BOX_VAL_FIELD), src.get_type().get_ptr_type());
+	vp.store(src, field, access_md(box_val_tbaa(box_class, env)));
+	return box;
+}
+
+// The value of an i32 or i1 constant such as int_const and bool_const
+// produce; other operands are spelled as %name or @name
+static bool get_const_operand(operand op, int &v)
+{
+	if (op.is_temp())
+		return false;
+	const string &s = op.get_spelling();
+	if (s == "true" || s == "false") {
+		v = s == "true";
+		return true;
+	}
+	char *end;
+	v = strtol(s.c_str(), &end, 10);
+	return !s.empty() && *end == 0;
+}
+
+// The static box of a small Int or of a Bool, see code_constants
+static operand code_box_constant(int v, Symbol box_class)
+{
+	op_type box_type(box_class->get_string(), 1);
+	if (box_class == Bool)
+		return global_value(box_type, v ? "Bool.true" : "Bool.false");
+	op_arr_type table(box_type.get_deref_type(), 
+		SMALL_INT_MAX - SMALL_INT_MIN + 1);
+	return const_value(box_type, "getelementptr (" + table.get_name() + ", " 
+		+ table.get_ptr_type().get_name() + " @Int.small, i32 0, i32 " 
+		+ itos(v - SMALL_INT_MIN) + ")", true);
+}
+
+// Attribute i of self, which follows the vtable pointer in the object
+static operand code_attr_field(int i, operand &obj, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	CgenNode *cls = env->get_class();
+	operand self_slot = *env->lookup(self);
+	obj = vp.load(self_slot.get_type().get_deref_type(), self_slot);
+	return vp.getelementptr(op_type(cls->get_type_name()), obj, int_value(0), 
+		int_value(i + 1), cls->get_attr_type(i).get_ptr_type());
+}
+
+static operand code_attr_load(int i, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	operand obj;
+	operand field = code_attr_field(i, obj, env);
+	return vp.load(field.get_type().get_deref_type(), field,
+		access_md(env->get_class()->get_attr_tbaa(i)));
+}
+
+// Self is loaded after the value has been computed, since computing it
+// may move self.  Storing an object into an old object must mark its
+// card for the generational collector.
+static void code_attr_store(int i, operand value, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	CgenNode *cls = env->get_class();
+	value = conform(value, cls->get_attr_type(i), env);
+	operand obj;
+	operand field = code_attr_field(i, obj, env);
+	vp.store(value, field, access_md(cls->get_attr_tbaa(i)));
+	if (cgen_Memmgr == GC_GENGC && value.get_type().get_id() == OBJ_PTR)
+		vp.call(vector<op_type>(), op_type(VOID), "cool_write_barrier", true,
+			vector<operand>(1, vp.bitcast(obj, op_type(INT8_PTR))));
+}
+
+operand conform(operand src, op_type type, CgenEnvironment *env) {
+	// ADD CODE HERE (PA5 ONLY)
+	ValuePrinter vp(*env->cur_stream);
+	op_type src_type = src.get_type();
+
+	if (src_type.is_same_with(type))
+		return src;
+
+	// Boxing: a Bool, or an Int in SMALL_INT_MIN..SMALL_INT_MAX, has a
+	// static box; any other Int gets a new object
+	if (src_type.get_id() == INT32 || src_type.get_id() == INT1) {
+		Symbol box_class = src_type.get_id() == INT32 ? Int : Bool;
+		op_type box_type(box_class->get_string(), 1);
+		int v;
+		operand box;
+		if (get_const_operand(src, v))
+			box = box_class == Bool || (v >= SMALL_INT_MIN && v <= SMALL_INT_MAX)
+				? code_box_constant(v, box_class)
+				: code_box_alloc(src, box_class, env);
+		else if (box_class == Bool)
+			box = vp.select(src, code_box_constant(1, Bool), 
+				code_box_constant(0, Bool));
+		else {
+			string small_br = env->new_label("box.", true);
+			string alloc_br = env->new_label("box.", true);
+			string end_br = env->new_label("box.", true);
+			operand merge = env->alloc_slot(box_type);
+			op_arr_type table(box_type.get_deref_type(), 
+				SMALL_INT_MAX - SMALL_INT_MIN + 1);
+
+			operand index = vp.sub(src, int_value(SMALL_INT_MIN));
+			vp.branch_cond(vp.icmp(ULT, index, 
+				int_value(SMALL_INT_MAX - SMALL_INT_MIN + 1)), small_br, alloc_br);
+
+			vp.begin_block(small_br);
+			vp.store(vp.getelementptr(table, global_value(table.get_ptr_type(), 
+				"Int.small"), int_value(0), index, box_type), merge);
+			vp.branch_uncond(end_br);
+
+			vp.begin_block(alloc_br);
+			vp.store(code_box_alloc(src, box_class, env), merge);
+			vp.branch_uncond(end_br);
+
+			vp.begin_block(end_br);
+			env->free_slot(merge);
+			box = vp.load(box_type, merge);
+		}
+		return box_type.is_same_with(type) ? box : vp.bitcast(box, type);
+	}
+
+	// Unboxing: the object is known to be an Int/Bool box
+	if (type.get_id() == INT32 || type.get_id() == INT1) {
+		Symbol box_class = type.get_id() == INT32 ? Int : Bool;
+		op_type box_type(box_class->get_string(), 1);
+		operand box = src_type.is_same_with(box_type) ? src 
+			: vp.bitcast(src, box_type);
+		operand field = vp.getelementptr(box_type.get_deref_type(), box, 
+			int_value(0), int_value(BOX_VAL_FIELD), type.get_ptr_type());
+		return vp.load(type, field, access_md(box_val_tbaa(box_class, env)));
+	}
+
+	return vp.bitcast(src, type);
+}
+
+// Retrieve the class tag from an object record.
+// src is the object we need the tag from.
+// src_class is the CgenNode for the *static* class of the expression.
+// You need to look up and return the class tag for it's dynamic value
+operand get_class_tag(operand src, CgenNode *src_cls, CgenEnvironment *env) {
+	// ADD CODE HERE (PA5 ONLY)
+	// Unboxed Int and Bool values have their static class
+	op_type_id id = src.get_type().get_id();
+	if (id == INT32 || id == INT1)
+		return int_value(src_cls->get_tag());
+
+	// The tag is the first field of the vtable.  An object never changes
+	// its vtable once set, and vtables are constants.
+	ValuePrinter vp(*env->cur_stream);
+	CgenClassTable *ct = src_cls->get_classtable();
+	string cls = src_cls->get_type_name();
+	op_type vtbl_ptr(cls + "_vtable", 1);
+	operand vtbl_slot = vp.getelementptr(op_type(cls), src, int_value(0), 
+		int_value(0), vtbl_ptr.get_ptr_type());
+	operand vtbl = vp.load(vtbl_ptr, vtbl_slot, 
+		access_md(ct->vtable_ptr_tbaa, false, true));
+	operand tag_slot = vp.getelementptr(vtbl_ptr.get_deref_type(), vtbl, 
+		int_value(0), int_value(0), op_type(INT32_PTR));
+	return vp.load(op_type(INT32), tag_slot, 
+		access_md(ct->vtable_tbaa, true));
+}
+
+//
+// Intrinsics
+//
+// String, Int and Bool cannot be inherited from, so a dispatch whose
+// receiver has one of them as its static class has a single target and
+// needs no vtable.  The builtins in the table below are generated inline
+// where that is possible, and as a direct call into the runtime where
+// the method needs it: allocation, bounds checks and the abort message.
+// Since none of the three classes overrides an Object method, the same
+// table serves static dispatch as well.
+//
+typedef operand (*intrinsic_coder)(Symbol cls, operand recv, 
+	vector<operand> &args, CgenEnvironment *env);
+
+// A string literal is the String constant of its stringtable entry
+static operand string_constant(StringEntry *e)
+{
+	return global_value(op_type(String->get_string(), 1), 
+		"String." + itos(e->get_index()));
+}
+
+// The type name of an exact class is a String constant
+static operand intrinsic_type_name(Symbol cls, operand recv, 
+	vector<operand> &args, CgenEnvironment *env)
+{
+	return string_constant(stringtable.lookup_string(cls->get_string()));
+}
+
+// Int and Bool are values and a String is never modified, so nothing can
+// tell a copy from the original
+static operand intrinsic_copy(Symbol cls, operand recv, 
+	vector<operand> &args, CgenEnvironment *env)
+{
+	return recv;
+}
+
+// abort prints the class name and exits, which is left to the runtime
+static operand intrinsic_abort(Symbol cls, operand recv, 
+	vector<operand> &args, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	op_type obj_ptr(Object->get_string(), 1);
+	return vp.call(vector<op_type>(), obj_ptr, "Object_abort", true, 
+		vector<operand>(1, conform(recv, obj_ptr, env)));
+}
+
+// Every String, flat or rope, carries its length
+static operand intrinsic_length(Symbol cls, operand recv, 
+	vector<operand> &args, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	operand len = vp.getelementptr(op_type(String->get_string()), recv, 
+		int_value(0), int_value(STRING_LEN_FIELD), op_type(INT32_PTR));
+	return vp.load(op_type(INT32), len);
+}
+
+// String methods with work to do are called without going through the
+// vtable
+
+static operand intrinsic_concat(Symbol cls, operand recv, 
+	vector<operand> &args, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	vector<operand> call_args(1, recv);
+	call_args.push_back(args[0]);
+	return vp.call(vector<op_type>(), recv.get_type(), "String_concat", true, 
+		call_args);
+}
+
+static operand intrinsic_substr(Symbol cls, operand recv, 
+	vector<operand> &args, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	vector<operand> call_args(1, recv);
+	call_args.push_back(args[0]);
+	call_args.push_back(args[1]);
+	return vp.call(vector<op_type>(), recv.get_type(), "String_substr", true, 
+		call_args);
+}
+
+static const struct {
+	Symbol *cls;
+	Symbol *method;
+	intrinsic_coder code;
+} intrinsics[] = {
+	{ &Int,    &type_name,  intrinsic_type_name },
+	{ &Int,    &cool_copy,  intrinsic_copy },
+	{ &Int,    &cool_abort, intrinsic_abort },
+	{ &Bool,   &type_name,  intrinsic_type_name },
+	{ &Bool,   &cool_copy,  intrinsic_copy },
+	{ &Bool,   &cool_abort, intrinsic_abort },
+	{ &String, &type_name,  intrinsic_type_name },
+	{ &String, &cool_copy,  intrinsic_copy },
+	{ &String, &cool_abort, intrinsic_abort },
+	{ &String, &length,     intrinsic_length },
+	{ &String, &concat,     intrinsic_concat },
+	{ &String, &substr,     intrinsic_substr },
+};
+
+// Generate method name of static class cls inline if it is an intrinsic.
+// Returns false, emitting nothing, otherwise.
+static bool code_intrinsic(Symbol cls, Symbol name, operand recv, 
+	vector<operand> &args, CgenEnvironment *env, operand &result)
+{
+	for (unsigned i = 0; i < sizeof(intrinsics) / sizeof(intrinsics[0]); i++) {
+		if (*intrinsics[i].cls == cls && *intrinsics[i].method == name) {
+			if (cgen_debug) 
+				std::cerr << "intrinsic " << cls << "." << name << endl;
+			for (unsigned j = 0; j < args.size(); j++)
+				args[j] = env->unspill(args[j]);
+			result = intrinsics[i].code(cls, recv, args, env);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Dispatch on void is a runtime error
+static void code_void_check(operand recv, int line, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	code_error_check(vp.icmp(EQ, recv, null_value(recv.get_type())), 
+		ERR_DISPATCH_VOID, line, env);
+}
+
+// The vtable of any object, as an Object's
+static operand code_object_vtable(operand obj, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	op_type obj_ptr(Object->get_string(), 1);
+	op_type vtbl_ptr(string(Object->get_string()) + "_vtable", 1);
+	if (!obj.get_type().is_same_with(obj_ptr))
+		obj = vp.bitcast(obj, obj_ptr);
+	return vp.load(vtbl_ptr, vp.getelementptr(obj_ptr.get_deref_type(), obj, 
+		int_value(0), int_value(0), vtbl_ptr.get_ptr_type()), 
+		access_md(env->get_class()->get_classtable()->vtable_ptr_tbaa, 
+		false, true));
+}
+
+// Object.copy: a new object of the size in the receiver's vtable, filled
+// by memcpy as new fills one from the prototype.  The receiver may be
+// spilled, and is reloaded after the allocation.
+static operand code_copy(operand recv, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	op_type obj_ptr(Object->get_string(), 1);
+	operand obj = recv.get_type().get_id() == OBJ_PPTR 
+		? vp.load(recv.get_type().get_deref_type(), recv) : recv;
+	operand vtbl = code_object_vtable(obj, env);
+	operand size = vp.load(op_type(INT32), vp.getelementptr(
+		vtbl.get_type().get_deref_type(), vtbl, int_value(0), 
+		int_value(VTABLE_SIZE_FIELD), op_type(INT32_PTR)),
+		access_md(env->get_class()->get_classtable()->vtable_tbaa, true));
+	operand copy = code_alloc(size, env);
+	code_memcpy(copy, env->unspill(recv), size, env);
+	return vp.bitcast(copy, obj_ptr);
+}
+
+// The arguments of a call to a function of type fn: Int and Bool values
+// passed to an object formal are boxed, and the receiver is cast to the
+// self type.  A box is allocated, so boxing comes first, while the other
+// values are still spilled.
+static vector<operand> code_call_args(op_func_type fn, operand recv, 
+	vector<operand> &args, CgenEnvironment *env)
+{
+	vector<op_type> types = fn.get_arg_types();
+	for (unsigned i = 0; i < args.size(); i++) {
+		op_type_id id = args[i].get_type().get_id();
+		if ((id == INT32 || id == INT1) && !args[i].get_type().is_same_with(types[i + 1]))
+			args[i] = env->spill(conform(args[i], types[i + 1], env));
+	}
+	vector<operand> call_args(1, conform(env->unspill(recv), types[0], env));
+	for (unsigned i = 0; i < args.size(); i++)
+		call_args.push_back(conform(env->unspill(args[i]), types[i + 1], env));
+	return call_args;
+}
+
+// Call the definition of method name in class impl without the vtable.
+// The receiver and arguments may be spilled.  A definition the analysis
+// removed can only be reached with a void receiver, which the caller has
+// already checked, so the call becomes the dead method stub.
+static operand code_direct_call(CgenNode *impl, Symbol name, operand recv, 
+	vector<operand> &args, bool tail, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	if (impl->get_name() == Object && name == cool_copy)
+		return code_copy(recv, env);
+	op_func_type fn = impl->method_type(name);
+	if (!impl->is_method_live(name)) {
+		vp.call(vector<op_type>(), op_type(VOID), DEAD_METHOD_STUB, true, 
+			vector<operand>());
+		vp.unreachable();
+		vp.begin_block(env->new_label("dead.", true));
+		return const_value(fn.get_result_type(), "undef", true);
+	}
+	vector<operand> call_args = code_call_args(fn, recv, args, env);
+	return vp.call(vector<op_type>(), fn.get_result_type(),
+		impl->get_type_name() + "_" + name->get_string(), true, call_args,
+		impl->method_cc(name), tail);
+}
+
+// Call method name through the vtable of the receiver.  The receiver is
+// seen as an object of the class that first defined the method, whose
+// vtable already has the slot, with the type of that definition.
+static operand code_vtable_call(CgenNode *cls, Symbol name, operand recv, 
+	vector<operand> &args, bool tail, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	CgenClassTable *ct = cls->get_classtable();
+	CgenNode *root = cls->method_root(name);
+	int slot = root->get_method_index(name);
+	op_func_type fn = root->get_slot_type(slot);
+	vector<operand> call_args = code_call_args(fn, recv, args, env);
+
+	op_type vtbl_ptr(root->get_type_name() + "_vtable", 1);
+	operand vtbl = vp.load(vtbl_ptr, vp.getelementptr(op_type(root->get_type_name()),
+		call_args[0], int_value(0), int_value(0), vtbl_ptr.get_ptr_type()), 
+		access_md(ct->vtable_ptr_tbaa, false, true));
+	operand fn_slot = vp.getelementptr(vtbl_ptr.get_deref_type(), vtbl, 
+		int_value(0), int_value(VTABLE_FIRST_METHOD + slot), fn.get_ptr_type());
+	operand target = vp.load(fn, fn_slot, access_md(ct->vtable_tbaa, true));
+	return vp.call(vector<op_type>(), fn.get_result_type(), 
+		target.get_name().substr(1), false, call_args, cls->method_cc(name), tail);
+}
+
+// A self tail call stores the arguments, and self if the receiver is
+// another object, into the parameter slots and restarts the method.  The
+// code after it is unreachable and gets an undef value.
+static operand code_self_tail_call(operand recv, bool new_self, 
+	vector<operand> &args, op_type result_type, int line, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	if (new_self) {
+		code_void_check(recv, line, env);
+		vp.store(conform(recv, env->params[0].get_type().get_deref_type(), env), 
+			env->params[0]);
+	}
+	for (unsigned i = 0; i < args.size(); i++)
+		vp.store(conform(env->unspill(args[i]), 
+			env->params[i + 1].get_type().get_deref_type(), env), 
+			env->params[i + 1]);
+	vp.branch_uncond(env->tail_label);
+	vp.begin_block(env->new_label("tailrec.", true));
+	return const_value(result_type, "undef", true);
+}
+#endif
+
+//
+// Create a method body
+// 
+void method_class::code(CgenEnvironment *env)
+{
+	if (cgen_debug) std::cerr << "method" << endl;
+	ValuePrinter vp(*env->cur_stream);
+#ifndef PA5
+	env->open_frame();
+	ValuePrinter body(*env->cur_stream);
+	body.ret(expr->code(env));
+	env->close_frame();
+#else
+	CgenNode *cls = env->get_class();
+	op_type ret_type = env->value_type(return_type);
+	vector<operand> args(1, operand(op_type(cls->get_type_name(), 1), "self"));
+	vector<Symbol> names(1, self);
+	for (int i = formals->first(); formals->more(i); i = formals->next(i)) {
+		Formal f = formals->nth(i);
+		args.push_back(operand(env->value_type(f->get_type_decl()), 
+			f->get_name()->get_string()));
+		names.push_back(f->get_name());
+	}
+	// Only main is called from outside the module.  Dispatch checks the
+	// receiver for void, and every object starts with its vtable pointer.
+	func_attrs attrs(cls->method_cc(name));
+	attrs.internal = true;
+	attrs.params.push_back("nonnull dereferenceable(8)");
+	if (cgen_Memmgr != GC_NOGC)
+		attrs.gc = "shadow-stack";
+	vp.define(ret_type, cls->get_type_name() + "_" + name->get_string(), args, 
+		attrs);
+	vp.begin_block("entry");
+	env->open_frame();
+	ValuePrinter body(*env->cur_stream);
+
+	// Parameters live in slots, so that a self tail call can store the
+	// new arguments and jump back instead of recursing
+	env->params.reserve(args.size());
+	for (unsigned i = 0; i < args.size(); i++) {
+		env->params.push_back(env->alloc_slot(args[i].get_type()));
+		body.store(args[i], env->params[i]);
+		env->add_local(names[i], env->params[i]);
+	}
+
+	vector<Expression> calls;
+	expr->find_tail_calls(calls);
+	for (unsigned i = 0; i < calls.size(); i++) {
+		if (calls[i]->is_self_recursion(cls, name))
+			env->self_tail_calls.insert(calls[i]);
+		else
+			env->tail_calls.insert(calls[i]);
+	}
+	// A tail call must not see the caller's frame
+	env->may_tail = !cls->get_classtable()->has_stack_objects(this);
+	if (!env->self_tail_calls.empty()) {
+		env->tail_label = env->new_label("tailrec.", true);
+		body.branch_uncond(env->tail_label);
+		body.begin_block(env->tail_label);
+	}
+
+	body.ret(conform(expr->code(env), ret_type, env));
+	env->close_frame();
+	vp.end_define();
+	for (unsigned i = 0; i < args.size(); i++)
+		env->kill_local();
+#endif
+}
+
+//
+// Codegen for expressions.  Note that each expression has a value.
+//
+
+operand assign_class::code(CgenEnvironment *env) 
+{ 
+	if (cgen_debug) std::cerr << "assign" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	operand new_value = expr->code(env);
+	operand *var = env->lookup(name);
+#ifdef PA5
+	// Not a local, so an attribute of self.  One that nothing reads has
+	// no slot, and the value is dropped.
+	if (!var) {
+		int i = env->get_class()->get_attr_index(name);
+		if (i >= 0)
+			code_attr_store(i, new_value, env);
+		return new_value;
+	}
+	vp.store(conform(new_value, var->get_type().get_deref_type(), env), *var);
+#else
+	vp.store(new_value, *var);
+#endif
+	return new_value;
+}
+
+operand cond_class::code(CgenEnvironment *env) 
+{ 
+	if (cgen_debug) std::cerr << "cond" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	string then_br = env->new_label("cond.", true);
+	string else_br = env->new_label("cond.", true);
+	string end_br = env->new_label("cond.", true);
+	op_type result_type = env->value_type(type);
+	operand merge = env->alloc_slot(result_type);
+
+	operand pred_operand = pred->code(env);
+
+	vp.branch_cond(pred_operand, then_br, else_br);
+
+	vp.begin_block(then_br);
+	operand then_operand = then_exp->code(env);
+#ifdef PA5
+	then_operand = conform(then_operand, result_type, env);
+#endif
+	vp.store(then_operand, merge);
+	vp.branch_uncond(end_br);
+
+	vp.begin_block(else_br);
+	operand else_operand = else_exp->code(env);
+#ifdef PA5
+	else_operand = conform(else_operand, result_type, env);
+#endif
+	vp.store(else_operand, merge);
+	vp.branch_uncond(end_br);
+
+	vp.begin_block(end_br);
+	env->free_slot(merge);
+	return vp.load(result_type, merge);
+}
+
+operand loop_class::code(CgenEnvironment *env) 
+{ 
+	if (cgen_debug) std::cerr << "loop" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	string loop_br = env->new_label("loop.", true);
+	string body_br = env->new_label("loop.", true);
+	string end_br = env->new_label("loop.", true);
+
+	vp.branch_uncond(loop_br);
+	vp.begin_block(loop_br);
+	operand pred_operand = pred->code(env);
+	vp.branch_cond(pred_operand, body_br, end_br);
+
+	vp.begin_block(body_br);
+	operand body_operand = body->code(env);
+	vp.branch_uncond(loop_br);
+
+	vp.begin_block(end_br);
+#ifdef PA5
+	// A loop evaluates to void
+	return null_value(env->value_type(type));
+#else
+	return body_operand;
+#endif
+} 
+
+operand block_class::code(CgenEnvironment *env) 
+{ 
+	if (cgen_debug) std::cerr << "block" << endl;
+	operand last_operand;
+	for(int i = body->first(); body->more(i); i = body->next(i)){
+		last_operand = body->nth(i)->code(env);
+	}
+#ifdef PA5
+	// The simplifier may leave a narrower value as the last expression
+	last_operand = conform(last_operand, env->value_type(type), env);
+#endif
+	return last_operand;
+}
+
+operand let_class::code(CgenEnvironment *env) 
+{ 
+	if (cgen_debug) std::cerr << "let" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	// Int and Bool lets hold the raw i32/i1, never a box
+	op_type var_type = env->value_type(type_decl);
+
+	// The initializer is in the enclosing scope
+	operand var_val = init->code(env);
+	operand var_alloca = env->alloc_slot(var_type);
+	env->add_local(identifier, var_alloca);
 
-	operand var_val = init->code(env);
 	if(var_val.get_type().get_id() == EMPTY){
 		string _val;
 		if(var_type.get_id() == INT1) _val = "false";
 		else if(var_type.get_id() == INT32) _val = "0";
+		else _val = "null";
+#ifdef PA5
+		// A String starts as "", never void
+		if (var_type.is_string_object())
+			vp.store(string_constant(stringtable.lookup_string("")), var_alloca);
+		else
+#endif
 		vp.store(const_value(var_type, _val, false), var_alloca);
 	}
-	else vp.store(var_val, var_alloca);
-	return body->code(env);
+#ifdef PA5
+	else vp.store(conform(var_val, var_type, env), var_alloca);
+#else
+	else vp.store(var_val, var_alloca);
+#endif
+	operand result = body->code(env);
+	env->kill_local();
+	env->free_slot(var_alloca);
+	return result;
+}
+
+operand plus_class::code(CgenEnvironment *env) 
+{ 
+	if (cgen_debug) std::cerr << "plus" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	operand e1_operand = e1->code(env);
+	operand e2_operand = e2->code(env);
+	return vp.add(e1_operand, e2_operand);
+}
+
+operand sub_class::code(CgenEnvironment *env) 
+{ 
+	if (cgen_debug) std::cerr << "sub" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	operand e1_operand = e1->code(env);
+	operand e2_operand = e2->code(env);
+	return vp.sub(e1_operand, e2_operand);
+}
+
+operand mul_class::code(CgenEnvironment *env) 
+{ 
+	if (cgen_debug) std::cerr << "mul" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	operand e1_operand = e1->code(env);
+	operand e2_operand = e2->code(env);
+	return vp.mul(e1_operand, e2_operand);
+}
+
+operand divide_class::code(CgenEnvironment *env) 
+{ 
+	if (cgen_debug) std::cerr << "div" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	operand e1_operand = e1->code(env);
+	operand e2_operand = e2->code(env);
+	int divisor;
+	bool is_const = e2->get_int_const(divisor);
+	if (is_const && divisor != 0 && divisor != -1)
+		return vp.div(e1_operand, e2_operand);
+	// sdiv of INT_MIN by -1 is undefined; Cool wraps around to INT_MIN,
+	// which is what negation gives
+	if (is_const && divisor == -1)
+		return vp.sub(int_value(0), e1_operand);
+
+	// Divisors 0 and -1 are the ones with e2 + 1 <u 2.  They share one
+	// unlikely branch to a block that reports division by zero or negates.
+	op_type int_type(INT32);
+	string special = env->new_label("div.", true);
+	string fast = env->new_label("div.", true);
+	string end = env->new_label("div.", true);
+	operand merge = env->alloc_slot(int_type);
+	vp.branch_cond(vp.icmp(ULT, vp.add(e2_operand, int_value(1)), 
+		int_value(2)), special, fast, MD_UNLIKELY);
+
+	vp.begin_block(fast);
+	vp.store(vp.div(e1_operand, e2_operand), merge);
+	vp.branch_uncond(end);
+
+	vp.begin_block(special);
+	code_error_check(vp.icmp(EQ, e2_operand, int_value(0)), 
+		ERR_DIV_ZERO, get_line_number(), env);
+	vp.store(vp.sub(int_value(0), e1_operand), merge);
+	vp.branch_uncond(end);
+
+	vp.begin_block(end);
+	env->free_slot(merge);
+	return vp.load(int_type, merge);
+}
+
+operand neg_class::code(CgenEnvironment *env) 
+{ 
+	if (cgen_debug) std::cerr << "neg" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	operand e1_operand = e1->code(env);
+	return vp.sub(int_value(0), e1_operand);
+}
+
+operand lt_class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "lt" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	operand e1_operand = e1->code(env);
+	operand e2_operand = e2->code(env);
+	return vp.icmp(LT, e1_operand, e2_operand);
+}
+
+#ifdef PA5
+// Strings are equal by content.  The same String, or two of different
+// lengths, are decided inline; String_equal compares cached hashes and
+// then the chars.  A String is never void.
+static operand code_string_eq(operand a, operand b, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	op_type bool_type(INT1), i32_type(INT32), str_type(String->get_string());
+	string len_br = env->new_label("streq.", true);
+	string chars_br = env->new_label("streq.", true);
+	string end_br = env->new_label("streq.", true);
+	operand merge = env->alloc_slot(bool_type);
+
+	operand same = vp.icmp(EQ, a, b);
+	vp.store(same, merge);
+	vp.branch_cond(same, end_br, len_br);
+
+	vp.begin_block(len_br);
+	operand len_a = vp.load(i32_type, vp.getelementptr(str_type, a, 
+		int_value(0), int_value(STRING_LEN_FIELD), op_type(INT32_PTR)));
+	operand len_b = vp.load(i32_type, vp.getelementptr(str_type, b, 
+		int_value(0), int_value(STRING_LEN_FIELD), op_type(INT32_PTR)));
+	operand same_len = vp.icmp(EQ, len_a, len_b);
+	vp.store(same_len, merge);
+	vp.branch_cond(same_len, chars_br, end_br);
+
+	vp.begin_block(chars_br);
+	vector<operand> args(1, a);
+	args.push_back(b);
+	vp.store(vp.call(vector<op_type>(), bool_type, "String_equal", true, args), 
+		merge);
+	vp.branch_uncond(end_br);
+
+	vp.begin_block(end_br);
+	env->free_slot(merge);
+	return vp.load(bool_type, merge);
+}
+
+// Two Objects, either of which may be an Int, Bool or String box, are
+// equal if they are the same object or boxes of the same class holding
+// equal values.  Small Ints and Bools have static boxes, but other Ints
+// are boxed afresh and Strings are created at run time.
+static operand code_object_eq(operand a, operand b, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	op_type bool_type(INT1), obj_ptr(Object->get_string(), 1);
+	op_type str_ptr(String->get_string(), 1);
+	CgenNode *obj_cls = env->type_to_class(Object);
+	string tag_br = env->new_label("objeq.", true);
+	string int_br = env->new_label("objeq.", true);
+	string bool_br = env->new_label("objeq.", true);
+	string str_br = env->new_label("objeq.", true);
+	string end_br = env->new_label("objeq.", true);
+	operand merge = env->alloc_slot(bool_type);
+	if (!a.get_type().is_same_with(obj_ptr))
+		a = vp.bitcast(a, obj_ptr);
+	if (!b.get_type().is_same_with(obj_ptr))
+		b = vp.bitcast(b, obj_ptr);
+
+	operand same = vp.icmp(EQ, a, b);
+	vp.store(same, merge);
+	vp.branch_cond(same, end_br, tag_br);
+
+	// Void only equals void, and the classes must match
+	vp.begin_block(tag_br);
+	vp.store(bool_value(false, true), merge);
+	operand any_void = vp.select(vp.icmp(EQ, a, null_value(obj_ptr)), 
+		bool_value(true, true), vp.icmp(EQ, b, null_value(obj_ptr)));
+	string same_br = env->new_label("objeq.", true);
+	vp.branch_cond(any_void, end_br, same_br);
+
+	vp.begin_block(same_br);
+	operand tag = get_class_tag(a, obj_cls, env);
+	string box_br = env->new_label("objeq.", true);
+	vp.branch_cond(vp.icmp(EQ, tag, get_class_tag(b, obj_cls, env)), 
+		box_br, end_br);
+
+	vp.begin_block(box_br);
+	vector<operand> tags;
+	vector<label> targets;
+	tags.push_back(int_value(env->type_to_class(Int)->get_tag()));
+	targets.push_back(int_br);
+	tags.push_back(int_value(env->type_to_class(Bool)->get_tag()));
+	targets.push_back(bool_br);
+	tags.push_back(int_value(env->type_to_class(String)->get_tag()));
+	targets.push_back(str_br);
+	vp.switch_in(tag, end_br, tags, targets);
+
+	vp.begin_block(int_br);
+	vp.store(vp.icmp(EQ, conform(a, op_type(INT32), env), 
+		conform(b, op_type(INT32), env)), merge);
+	vp.branch_uncond(end_br);
+
+	vp.begin_block(bool_br);
+	vp.store(vp.icmp(EQ, conform(a, bool_type, env), 
+		conform(b, bool_type, env)), merge);
+	vp.branch_uncond(end_br);
+
+	vp.begin_block(str_br);
+	vp.store(code_string_eq(vp.bitcast(a, str_ptr), vp.bitcast(b, str_ptr), 
+		env), merge);
+	vp.branch_uncond(end_br);
+
+	vp.begin_block(end_br);
+	env->free_slot(merge);
+	return vp.load(bool_type, merge);
+}
+#endif
+
+operand eq_class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "eq" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	operand e1_operand = env->spill(e1->code(env));
+	operand e2_operand = e2->code(env);
+#ifdef PA5
+	if (e1->get_type() == String)
+		return code_string_eq(env->unspill(e1_operand), e2_operand, env);
+	// Only an Object may hold a box; other classes compare by identity
+	CgenNode *obj_cls = env->type_to_class(Object);
+	if (env->type_to_class(e1->get_type()) == obj_cls 
+	    && env->type_to_class(e2->get_type()) == obj_cls)
+		return code_object_eq(env->unspill(e1_operand), e2_operand, env);
+#endif
+	return vp.icmp(EQ, env->unspill(e1_operand), e2_operand);
+}
+
+operand leq_class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "leq" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	operand e1_operand = e1->code(env);
+	operand e2_operand = e2->code(env);
+	return vp.icmp(LE, e1_operand, e2_operand);
+}
+
+operand comp_class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "complement" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	operand e1_operand = e1->code(env);
+	return vp.xor_in(e1_operand, bool_value(true, 0));
+}
+
+operand int_const_class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "Integer Constant" << endl;
+	return int_value(atoi(token->get_string()));
+}
+
+operand bool_const_class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "Boolean Constant" << endl;
+	return bool_value(val, 0);
+}
+
+operand object_class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "Object" << endl;
+	ValuePrinter vp(*env->cur_stream);
+	operand *var = env->lookup(name);
+#ifdef PA5
+	if (!var)
+		return code_attr_load(env->get_class()->get_attr_index(name), env);
+#endif
+	return vp.load(var->get_type().get_deref_type(), *var);
+}
+
+operand no_expr_class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "No_expr" << endl;
+	// No value: let and attr_class::code leave the default in place
+	return operand();
+}
+
+//*****************************************************************
+// The next few functions are for node types not supported in Phase 1
+// but these functions must be defined because they are declared as
+// methods via the Expression_SHARED_EXTRAS hack.
+//*****************************************************************
+
+operand static_dispatch_class::code(CgenEnvironment *env) 
+{ 
+	if (cgen_debug) std::cerr << "static dispatch" << endl;
+#ifndef PA5
+	assert(0 && "Unsupported case for phase 1");
+#else
+	// The arguments are evaluated before the receiver
+	vector<operand> args;
+	for (int i = actual->first(); actual->more(i); i = actual->next(i))
+		args.push_back(env->spill(actual->nth(i)->code(env)));
+	operand recv = expr->code(env);
+
+	operand result;
+	if (code_intrinsic(expr->get_type(), name, recv, args, env, result))
+		return result;
+	op_type result_type = env->value_type(get_type());
+	if (env->self_tail_calls.count(this))
+		return code_self_tail_call(recv, !expr->is_self(), args, result_type, 
+			get_line_number(), env);
+
+	CgenNode *impl = env->type_to_class(type_name)->lookup_method(name);
+	if (!expr->is_self())
+		code_void_check(recv, get_line_number(), env);
+	bool tail = env->may_tail && env->tail_calls.count(this);
+	return conform(code_direct_call(impl, name, env->spill(recv), args, tail, 
+		env), result_type, env);
+#endif
+	return operand();
+}
+
+operand string_const_class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "string_const" << endl;
+#ifndef PA5
+	assert(0 && "Unsupported case for phase 1");
+#else
+	// Equal literals are one stringtable entry, so one constant
+	return string_constant((StringEntry *) token);
+#endif
+	return operand();
+}
+
+operand dispatch_class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "dispatch" << endl;
+#ifndef PA5
+	assert(0 && "Unsupported case for phase 1");
+#else
+	// The arguments are evaluated before the receiver
+	vector<operand> args;
+	for (int i = actual->first(); actual->more(i); i = actual->next(i))
+		args.push_back(env->spill(actual->nth(i)->code(env)));
+	operand recv = expr->code(env);
+
+	operand result;
+	if (code_intrinsic(expr->get_type(), name, recv, args, env, result))
+		return result;
+	op_type result_type = env->value_type(get_type());
+	if (env->self_tail_calls.count(this))
+		return code_self_tail_call(recv, false, args, result_type, 
+			get_line_number(), env);
+
+	CgenNode *cls = env->type_to_class(expr->get_type());
+	if (!expr->is_self())
+		code_void_check(recv, get_line_number(), env);
+	bool tail = env->may_tail && env->tail_calls.count(this);
+	// With a single reachable definition the vtable is not needed
+	if (!cls->has_live_override(name))
+		return conform(code_direct_call(cls->lookup_method(name), name, 
+			env->spill(recv), args, tail, env), result_type, env);
+	return conform(code_vtable_call(cls, name, env->spill(recv), args, tail, 
+		env), result_type, env);
+#endif
+	return operand();
+}
+
+#ifdef PA5
+// A run of consecutive class tags that select the same case branch
+// (-1 for none)
+struct TagRange {
+	int first, last, branch;
+};
+
+// Binary search over ranges[lo..hi] on the tag, ending in a jump to the
+// block of the branch each range selects.  Called with lo < hi.
+static void code_tag_search(operand tag, vector<TagRange> &ranges, int lo, 
+	int hi, vector<string> &labels, string nomatch, CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	int mid = (lo + hi + 1) / 2;
+	int bounds[2][2] = { { lo, mid - 1 }, { mid, hi } };
+	string targets[2];
+	for (int i = 0; i < 2; i++) {
+		int b = ranges[bounds[i][0]].branch;
+		if (bounds[i][0] < bounds[i][1])
+			targets[i] = env->new_label("case.", true);
+		else
+			targets[i] = b < 0 ? nomatch : labels[b];
+	}
+	vp.branch_cond(vp.icmp(LT, tag, int_value(ranges[mid].first)), 
+		targets[0], targets[1]);
+	for (int i = 0; i < 2; i++) {
+		if (bounds[i][0] == bounds[i][1])
+			continue;
+		vp.begin_block(targets[i]);
+		code_tag_search(tag, ranges, bounds[i][0], bounds[i][1], labels, 
+			nomatch, env);
+	}
+}
+#endif
+
+//
+// Tags are given in preorder, so the subclasses of a class are the tags
+// from its own up to its max_child, and the tags of two branch classes
+// are either nested or disjoint.  The tags the expression may have are
+// split into ranges that select the same branch (the innermost one), and
+// the branch is found with a jump table when the ranges are short, and
+// with a binary search over the ranges otherwise: O(log n) compares for
+// n branches, never a test per branch.
+//
+operand typcase_class::code(CgenEnvironment *env)
+{
+	if (cgen_debug) 
+		std::cerr << "typecase::code()" << endl;
+#ifndef PA5
+	assert(0 && "Unsupported case for phase 1");
+#else
+	ValuePrinter vp(*env->cur_stream);
+	op_type join_type = env->value_type(type);
+	operand val = expr->code(env);
+	CgenNode *src_cls = env->type_to_class(expr->get_type());
+	op_type_id id = val.get_type().get_id();
+	bool unboxed = id == INT32 || id == INT1;
+
+	string abort_br = env->new_label("case.nomatch.", true);
+	string end_br = env->new_label("case.end.", true);
+	if (!unboxed)
+		code_error_check(vp.icmp(EQ, val, null_value(val.get_type())), 
+			ERR_CASE_VOID, get_line_number(), env);
+	operand tag = get_class_tag(val, src_cls, env);
+
+	// Innermost branch for every tag the value may have: paint the
+	// branches from the widest tag range to the narrowest
+	int lo = src_cls->get_tag(), hi = unboxed ? lo : src_cls->get_max_child();
+	vector<int> order, select(hi - lo + 1, -1);
+	vector<CgenNode*> branch_cls;
+	for (int i = cases->first(); cases->more(i); i = cases->next(i)) {
+		order.push_back(branch_cls.size());
+		branch_cls.push_back(env->type_to_class(cases->nth(i)->get_type_decl()));
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		CgenNode *x = branch_cls[a], *y = branch_cls[b];
+		return x->get_max_child() - x->get_tag() > y->get_max_child() - y->get_tag();
+	});
+	for (unsigned i = 0; i < order.size(); i++) {
+		CgenNode *c = branch_cls[order[i]];
+		for (int t = std::max(lo, c->get_tag()); t <= std::min(hi, c->get_max_child()); t++)
+			select[t - lo] = order[i];
+	}
+	vector<TagRange> ranges;
+	for (int t = lo; t <= hi; t++) {
+		if (!ranges.empty() && ranges.back().branch == select[t - lo])
+			ranges.back().last = t;
+		else {
+			TagRange r = { t, t, select[t - lo] };
+			ranges.push_back(r);
+		}
+	}
+
+	// Branches that no possible tag selects are not generated
+	vector<string> labels(branch_cls.size());
+	for (unsigned i = 0; i < ranges.size(); i++)
+		if (ranges[i].branch >= 0 && labels[ranges[i].branch].empty())
+			labels[ranges[i].branch] = env->new_label("case.branch.", true);
+
+	operand result = env->alloc_slot(join_type);
+
+	if (ranges.size() == 1) {
+		vp.branch_uncond(ranges[0].branch < 0 ? abort_br : labels[ranges[0].branch]);
+	} else if (hi - lo + 1 <= 2 * (int) ranges.size()) {
+		// Dense: one switch case per tag, which LLVM makes a jump table
+		vector<operand> values;
+		vector<string> targets;
+		for (int t = lo; t <= hi; t++) {
+			if (select[t - lo] < 0)
+				continue;
+			values.push_back(int_value(t));
+			targets.push_back(labels[select[t - lo]]);
+		}
+		vp.switch_in(tag, abort_br, values, targets);
+	} else {
+		code_tag_search(tag, ranges, 0, ranges.size() - 1, labels, abort_br, env);
+	}
+
+	code_error_block(abort_br, ERR_CASE_NO_MATCH, get_line_number(), env);
+
+	env->branch_operand = result;
+	env->next_label = end_br;
+	for (unsigned i = 0; i < branch_cls.size(); i++) {
+		if (labels[i].empty())
+			continue;
+		vp.begin_block(labels[i]);
+		cases->nth(cases->first() + i)->code(val, tag, join_type, env);
+	}
+
+	vp.begin_block(end_br);
+	env->free_slot(result);
+	return vp.load(join_type, result);
+#endif
+	return operand();
+}
+
+#ifdef PA5
+// The class of self is only known at runtime, so its _new is called
+// through the vtable
+static operand code_new_self(CgenEnvironment *env)
+{
+	ValuePrinter vp(*env->cur_stream);
+	op_type obj_ptr(Object->get_string(), 1);
+	op_func_type new_type(obj_ptr, vector<op_type>());
+	operand self_slot = *env->lookup(self);
+	operand vtbl = code_object_vtable(vp.load(
+		self_slot.get_type().get_deref_type(), self_slot), env);
+	operand new_slot = vp.getelementptr(vtbl.get_type().get_deref_type(), vtbl, 
+		int_value(0), int_value(VTABLE_NEW_FIELD), 
+		op_func_ptr_type(obj_ptr, vector<op_type>()));
+	operand fn = vp.load(new_type, new_slot, 
+		access_md(env->get_class()->get_classtable()->vtable_tbaa, true));
+	operand result = vp.call(vector<op_type>(), obj_ptr, 
+		fn.get_name().substr(1), false, vector<operand>());
+	return vp.bitcast(result, env->value_type(SELF_TYPE));
+}
+#endif
+
+operand new__class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "newClass" << endl;
+#ifndef PA5
+	assert(0 && "Unsupported case for phase 1");
+#else
+	ValuePrinter vp(*env->cur_stream);
+	if (type_name == SELF_TYPE)
+		return code_new_self(env);
+
+	// Int and Bool are unboxed: new gives the default value
+	op_type val_type = env->value_type(type_name);
+	if (val_type.get_id() == INT32)
+		return int_value(0);
+	if (val_type.get_id() == INT1)
+		return bool_value(false, true);
+
+	// A class of the program starts as a copy of its prototype; the
+	// runtime creates the basic ones, which are never stack sites
+	CgenNode *node = env->type_to_class(type_name);
+	if (!node->basic())
+		return code_new_object(node, 
+			env->get_class()->get_classtable()->is_stack_site(this), env);
+	return vp.call(vector<op_type>(), val_type, node->get_type_name() + "_new", 
+		true, vector<operand>());
+#endif
+	return operand();
+}
+
+operand isvoid_class::code(CgenEnvironment *env) 
+{
+	if (cgen_debug) std::cerr << "isvoid" << endl;
+#ifndef PA5
+	assert(0 && "Unsupported case for phase 1");
+#else
+	ValuePrinter vp(*env->cur_stream);
+	operand val = e1->code(env);
+	// Unboxed Int and Bool values are never void
+	op_type_id id = val.get_type().get_id();
+	if (id == INT32 || id == INT1)
+		return bool_value(false, true);
+	return vp.icmp(EQ, val, null_value(val.get_type()));
+#endif
+	return operand();
+}
+
+// Create the LLVM Function corresponding to this method.
+void method_class::layout_feature(CgenNode *cls) 
+{
+#ifndef PA5
+	assert(0 && "Unsupported case for phase 1");
+#else
+	// ADD CODE HERE
+	cls->add_method(name);
+#endif
+}
+
+// If the source tag is >= the branch tag and <= (max child of the branch class) tag,
+// then the branch is a superclass of the source.  typcase_class::code has
+// made that test and jumps here: bind the value and store the result in
+// env->branch_operand, then continue at env->next_label.
+operand branch_class::code(operand expr_val, operand tag,
+				op_type join_type, CgenEnvironment *env) {
+#ifndef PA5
+	assert(0 && "Unsupported case for phase 1");
+#else
+	ValuePrinter vp(*env->cur_stream);
+	// A nested case in the body resets these
+	operand result_slot = env->branch_operand;
+	string end_br = env->next_label;
+
+	op_type var_type = env->value_type(type_decl);
+	operand var = env->alloc_slot(var_type);
+	vp.store(conform(expr_val, var_type, env), var);
+	env->add_local(name, var);
+	operand result = conform(expr->code(env), join_type, env);
+	env->kill_local();
+	env->free_slot(var);
+
+	vp.store(result, result_slot);
+	vp.branch_uncond(end_br);
+	return result;
+#endif
+	return operand();
+}
+
+// Assign this attribute a slot in the class structure
+void attr_class::layout_feature(CgenNode *cls)
+{
+#ifndef PA5
+	assert(0 && "Unsupported case for phase 1");
+#else
+	// ADD CODE HERE
+	cls->add_attribute(this);
+#endif
+}
+
+// Run the initializer, if any, on the object in self.  Without one the
+// attribute keeps its default, which came with the prototype, as did
+// the value of a constant initializer in the prototype.
+void attr_class::code(CgenEnvironment *env)
+{
+#ifndef PA5
+	assert(0 && "Unsupported case for phase 1");
+#else
+	// ADD CODE HERE
+	if (env->get_class()->in_prototype(this))
+		return;
+	operand val = init->code(env);
+	if (val.get_type().get_id() == EMPTY)
+		return;
+	int i = env->get_class()->get_attr_index(name);
+	if (i >= 0)
+		code_attr_store(i, val, env);
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+//
+// Tail calls
+//
+// A call in tail position whose target is certainly the method being
+// generated becomes a jump to the top of the method: a dispatch on self
+// that no live subclass overrides, or a static dispatch naming the class
+// that defines the method.
+//
+////////////////////////////////////////////////////////////////////////////
+
+bool object_class::is_self()
+{
+	return name == self;
+}
+
+bool dispatch_class::is_self_recursion(CgenNode *cls, Symbol method)
+{
+	return name == method && expr->is_self() && !cls->has_live_override(name);
+}
+
+bool static_dispatch_class::is_self_recursion(CgenNode *cls, Symbol method)
+{
+	return name == method 
+		&& cls->get_classtable()->lookup(type_name)->lookup_method(name) == cls;
+}
+
+bool method_class::has_self_tail_call(CgenNode *cls)
+{
+	std::vector<Expression> calls;
+	expr->find_tail_calls(calls);
+	for (unsigned i = 0; i < calls.size(); i++)
+		if (calls[i]->is_self_recursion(cls, name))
+			return true;
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//
+// APS class methods: reachability walk
+//
+// Each node reports what it instantiates, dispatches to and reads, then
+// walks its subexpressions.
+//
+////////////////////////////////////////////////////////////////////////////
+
+void method_class::reach(ReachEnvironment *env)
+{
+	for (int i = formals->first(); formals->more(i); i = formals->next(i))
+		env->add_local(formals->nth(i)->get_name(), 
+			formals->nth(i)->get_type_decl());
+	expr->reach(env);
+}
+
+void attr_class::reach(ReachEnvironment *env)
+{
+	init->reach(env);
+}
+
+void branch_class::reach(ReachEnvironment *env)
+{
+	env->add_local(name, type_decl);
+	expr->reach(env);
+	env->kill_local();
+}
+
+void assign_class::reach(ReachEnvironment *env)
+{
+	expr->reach(env);
+}
+
+void static_dispatch_class::reach(ReachEnvironment *env)
+{
+	expr->reach(env);
+	for (int i = actual->first(); actual->more(i); i = actual->next(i))
+		actual->nth(i)->reach(env);
+	env->static_dispatch(type_name, name);
+}
+
+void dispatch_class::reach(ReachEnvironment *env)
+{
+	expr->reach(env);
+	for (int i = actual->first(); actual->more(i); i = actual->next(i))
+		actual->nth(i)->reach(env);
+	env->dispatch(expr->get_type(), name);
+}
+
+void cond_class::reach(ReachEnvironment *env)
+{
+	pred->reach(env);
+	then_exp->reach(env);
+	else_exp->reach(env);
+}
+
+void loop_class::reach(ReachEnvironment *env)
+{
+	pred->reach(env);
+	body->reach(env);
+}
+
+void typcase_class::reach(ReachEnvironment *env)
+{
+	expr->reach(env);
+	for (int i = cases->first(); cases->more(i); i = cases->next(i))
+		cases->nth(i)->reach(env);
+}
+
+void block_class::reach(ReachEnvironment *env)
+{
+	for (int i = body->first(); body->more(i); i = body->next(i))
+		body->nth(i)->reach(env);
+}
+
+void let_class::reach(ReachEnvironment *env)
+{
+	init->reach(env);
+	env->add_local(identifier, type_decl);
+	body->reach(env);
+	env->kill_local();
+}
+
+void plus_class::reach(ReachEnvironment *env)
+{
+	e1->reach(env);
+	e2->reach(env);
+}
+
+void sub_class::reach(ReachEnvironment *env)
+{
+	e1->reach(env);
+	e2->reach(env);
+}
+
+void mul_class::reach(ReachEnvironment *env)
+{
+	e1->reach(env);
+	e2->reach(env);
+}
+
+void divide_class::reach(ReachEnvironment *env)
+{
+	e1->reach(env);
+	e2->reach(env);
+}
+
+void neg_class::reach(ReachEnvironment *env)
+{
+	e1->reach(env);
+}
+
+void lt_class::reach(ReachEnvironment *env)
+{
+	e1->reach(env);
+	e2->reach(env);
+}
+
+void eq_class::reach(ReachEnvironment *env)
+{
+	e1->reach(env);
+	e2->reach(env);
+}
+
+void leq_class::reach(ReachEnvironment *env)
+{
+	e1->reach(env);
+	e2->reach(env);
+}
+
+void comp_class::reach(ReachEnvironment *env)
+{
+	e1->reach(env);
+}
+
+void int_const_class::reach(ReachEnvironment *env) { }
+
+void bool_const_class::reach(ReachEnvironment *env) { }
+
+void string_const_class::reach(ReachEnvironment *env) { }
+
+void new__class::reach(ReachEnvironment *env)
+{
+	env->instantiate(type_name);
+}
+
+void isvoid_class::reach(ReachEnvironment *env)
+{
+	e1->reach(env);
+}
+
+void no_expr_class::reach(ReachEnvironment *env) { }
+
+void object_class::reach(ReachEnvironment *env)
+{
+	env->read(name);
+}
+
+////////////////////////////////////////////////////////////////////////////
+//
+// APS class methods: escape analysis
+//
+// Each expression returns what it may evaluate to and reports values
+// that escape to the environment.
+//
+////////////////////////////////////////////////////////////////////////////
+
+void method_class::escape(EscapeEnvironment *env)
+{
+	vector<tree_node*> params;
+	for (int i = formals->first(); formals->more(i); i = formals->next(i)) {
+		Formal f = formals->nth(i);
+		env->add_local(f->get_name(), f, EscapeSet());
+		params.push_back(f);
+	}
+	env->summarize(expr->escape(env), params);
+}
+
+// Initial values are stored into the new object
+void attr_class::escape(EscapeEnvironment *env)
+{
+	env->escape(init->escape(env));
+}
+
+EscapeSet branch_class::escape(EscapeSet expr_val, EscapeEnvironment *env)
+{
+	env->add_local(name, this, expr_val);
+	EscapeSet v = expr->escape(env);
+	env->kill_local();
+	return v;
+}
+
+EscapeSet assign_class::escape(EscapeEnvironment *env)
+{
+	EscapeSet v = expr->escape(env);
+	env->assign(name, v);
+	return v;
+}
+
+EscapeSet static_dispatch_class::escape(EscapeEnvironment *env)
+{
+	EscapeSet recv = expr->escape(env);
+	vector<EscapeSet> args;
+	for (int i = actual->first(); actual->more(i); i = actual->next(i))
+		args.push_back(actual->nth(i)->escape(env));
+	return env->dispatch(env->type_to_class(type_name), name, true, recv, args);
+}
+
+EscapeSet dispatch_class::escape(EscapeEnvironment *env)
+{
+	EscapeSet recv = expr->escape(env);
+	vector<EscapeSet> args;
+	for (int i = actual->first(); actual->more(i); i = actual->next(i))
+		args.push_back(actual->nth(i)->escape(env));
+	return env->dispatch(env->type_to_class(expr->get_type()), name, false, 
+		recv, args);
+}
+
+EscapeSet cond_class::escape(EscapeEnvironment *env)
+{
+	pred->escape(env);
+	EscapeSet v = then_exp->escape(env);
+	EscapeSet e = else_exp->escape(env);
+	v.insert(e.begin(), e.end());
+	return v;
+}
+
+EscapeSet loop_class::escape(EscapeEnvironment *env)
+{
+	env->enter_loop();
+	pred->escape(env);
+	body->escape(env);
+	env->exit_loop();
+	return EscapeSet();
+}
+
+EscapeSet typcase_class::escape(EscapeEnvironment *env)
+{
+	EscapeSet scrutinee = expr->escape(env);
+	EscapeSet v;
+	for (int i = cases->first(); cases->more(i); i = cases->next(i)) {
+		EscapeSet b = cases->nth(i)->escape(scrutinee, env);
+		v.insert(b.begin(), b.end());
+	}
+	return v;
 }
 
-operand plus_class::code(CgenEnvironment *env) 
-{ 
-	if (cgen_debug) std::cerr << "plus" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	operand e1_operand = e1->code(env);
-	operand e2_operand = e2->code(env);
-	return vp.add(e1_operand, e2_operand);
+EscapeSet block_class::escape(EscapeEnvironment *env)
+{
+	EscapeSet v;
+	for (int i = body->first(); body->more(i); i = body->next(i))
+		v = body->nth(i)->escape(env);
+	return v;
 }
 
-operand sub_class::code(CgenEnvironment *env) 
-{ 
-	if (cgen_debug) std::cerr << "sub" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	operand e1_operand = e1->code(env);
-	operand e2_operand = e2->code(env);
-	return vp.sub(e1_operand, e2_operand);
+EscapeSet let_class::escape(EscapeEnvironment *env)
+{
+	EscapeSet init_val = init->escape(env);
+	env->add_local(identifier, this, init_val);
+	EscapeSet v = body->escape(env);
+	env->kill_local();
+	return v;
 }
 
-operand mul_class::code(CgenEnvironment *env) 
-{ 
-	if (cgen_debug) std::cerr << "mul" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	operand e1_operand = e1->code(env);
-	operand e2_operand = e2->code(env);
-	return vp.mul(e1_operand, e2_operand);
+EscapeSet plus_class::escape(EscapeEnvironment *env)
+{
+	e1->escape(env);
+	e2->escape(env);
+	return EscapeSet();
 }
 
-operand divide_class::code(CgenEnvironment *env) 
-{ 
-	if (cgen_debug) std::cerr << "div" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	operand e1_operand = e1->code(env);
-	operand e2_operand = e2->code(env);
-	return vp.div(e1_operand, e2_operand);
+EscapeSet sub_class::escape(EscapeEnvironment *env)
+{
+	e1->escape(env);
+	e2->escape(env);
+	return EscapeSet();
 }
 
-operand neg_class::code(CgenEnvironment *env) 
-{ 
-	if (cgen_debug) std::cerr << "neg" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	operand e1_operand = e1->code(env);
-	return vp.sub(int_value(0), e1_operand);
+EscapeSet mul_class::escape(EscapeEnvironment *env)
+{
+	e1->escape(env);
+	e2->escape(env);
+	return EscapeSet();
 }
 
-operand lt_class::code(CgenEnvironment *env) 
+EscapeSet divide_class::escape(EscapeEnvironment *env)
 {
-	if (cgen_debug) std::cerr << "lt" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	operand e1_operand = e1->code(env);
-	operand e2_operand = e2->code(env);
-	return vp.icmp(LT, e1_operand, e2_operand);
+	e1->escape(env);
+	e2->escape(env);
+	return EscapeSet();
 }
 
-operand eq_class::code(CgenEnvironment *env) 
+EscapeSet neg_class::escape(EscapeEnvironment *env)
 {
-	if (cgen_debug) std::cerr << "eq" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	operand e1_operand = e1->code(env);
-	operand e2_operand = e2->code(env);
-	return vp.icmp(EQ, e1_operand, e2_operand);
+	e1->escape(env);
+	return EscapeSet();
 }
 
-operand leq_class::code(CgenEnvironment *env) 
+EscapeSet lt_class::escape(EscapeEnvironment *env)
 {
-	if (cgen_debug) std::cerr << "leq" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	operand e1_operand = e1->code(env);
-	operand e2_operand = e2->code(env);
-	return vp.icmp(LE, e1_operand, e2_operand);
+	e1->escape(env);
+	e2->escape(env);
+	return EscapeSet();
 }
 
-operand comp_class::code(CgenEnvironment *env) 
+// Comparing pointers does not let either side escape
+EscapeSet eq_class::escape(EscapeEnvironment *env)
 {
-	if (cgen_debug) std::cerr << "complement" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	operand e1_operand = e1->code(env);
-	return vp.xor_in(e1_operand, bool_value(true, 0));
+	e1->escape(env);
+	e2->escape(env);
+	return EscapeSet();
 }
 
-operand int_const_class::code(CgenEnvironment *env) 
+EscapeSet leq_class::escape(EscapeEnvironment *env)
 {
-	if (cgen_debug) std::cerr << "Integer Constant" << endl;
-	return int_value(atoi(token->get_string()));
+	e1->escape(env);
+	e2->escape(env);
+	return EscapeSet();
 }
 
-operand bool_const_class::code(CgenEnvironment *env) 
+EscapeSet comp_class::escape(EscapeEnvironment *env)
 {
-	if (cgen_debug) std::cerr << "Boolean Constant" << endl;
-	return bool_value(val, 0);
+	e1->escape(env);
+	return EscapeSet();
 }
 
-operand object_class::code(CgenEnvironment *env) 
+EscapeSet int_const_class::escape(EscapeEnvironment *env) { return EscapeSet(); }
+
+EscapeSet bool_const_class::escape(EscapeEnvironment *env) { return EscapeSet(); }
+
+EscapeSet string_const_class::escape(EscapeEnvironment *env) { return EscapeSet(); }
+
+// Only user classes with a known size are candidates; new SELF_TYPE
+// and the basic classes always go to the heap
+EscapeSet new__class::escape(EscapeEnvironment *env)
 {
-	if (cgen_debug) std::cerr << "Object" << endl;
-	ValuePrinter vp(*env->cur_stream);
-	operand obj = *env->lookup(name);
-	return vp.load(obj.get_type().get_deref_type(), obj);
+	if (type_name == SELF_TYPE || env->type_to_class(type_name)->basic())
+		return EscapeSet();
+	return env->alloc(this);
 }
 
-operand no_expr_class::code(CgenEnvironment *env) 
+EscapeSet isvoid_class::escape(EscapeEnvironment *env)
 {
-	if (cgen_debug) std::cerr << "No_expr" << endl;
-	// ADD CODE HERE AND REPLACE "return operand()" WITH SOMETHING 
-	// MORE MEANINGFUL
-	return operand();
+	e1->escape(env);
+	return EscapeSet();
 }
 
-//*****************************************************************
-// The next few functions are for node types not supported in Phase 1
-// but these functions must be defined because they are declared as
-// methods via the Expression_SHARED_EXTRAS hack.
-//*****************************************************************
+EscapeSet no_expr_class::escape(EscapeEnvironment *env) { return EscapeSet(); }
 
-operand static_dispatch_class::code(CgenEnvironment *env) 
-{ 
-	if (cgen_debug) std::cerr << "static dispatch" << endl;
-#ifndef PA5
-	assert(0 && "Unsupported case for phase 1");
-#else
-	// ADD CODE HERE AND REPLACE "return operand()" WITH SOMETHING 
-	// MORE MEANINGFUL
-#endif
-	return operand();
+EscapeSet object_class::escape(EscapeEnvironment *env)
+{
+	return env->lookup(name);
 }
 
-operand string_const_class::code(CgenEnvironment *env) 
+
+////////////////////////////////////////////////////////////////////////////
+//
+// APS class methods: simplification
+//
+// Each expression simplifies its subexpressions and returns the
+// expression that should replace it.  Int arithmetic wraps at 32 bits,
+// so folding is done on unsigned values.
+//
+////////////////////////////////////////////////////////////////////////////
+
+static Expressions simplify_all(Expressions es, SimplifyEnvironment *env)
 {
-	if (cgen_debug) std::cerr << "string_const" << endl;
-#ifndef PA5
-	assert(0 && "Unsupported case for phase 1");
-#else
-	// ADD CODE HERE AND REPLACE "return operand()" WITH SOMETHING 
-	// MORE MEANINGFUL
-#endif
-	return operand();
+	Expressions out = nil_Expressions();
+	for (int i = es->first(); es->more(i); i = es->next(i))
+		out = append_Expressions(out, 
+			single_Expressions(es->nth(i)->simplify(env)));
+	return out;
 }
 
-operand dispatch_class::code(CgenEnvironment *env) 
+static bool is_int(Expression e, int v)
 {
-	if (cgen_debug) std::cerr << "dispatch" << endl;
-#ifndef PA5
-	assert(0 && "Unsupported case for phase 1");
-#else
-	// ADD CODE HERE AND REPLACE "return operand()" WITH SOMETHING 
-	// MORE MEANINGFUL
-#endif
-	return operand();
+	int c;
+	return e->get_int_const(c) && c == v;
 }
 
-operand typcase_class::code(CgenEnvironment *env)
+void method_class::simplify(SimplifyEnvironment *env)
 {
-	if (cgen_debug) 
-		std::cerr << "typecase::code()" << endl;
-#ifndef PA5
-	assert(0 && "Unsupported case for phase 1");
-#else
-	// ADD CODE HERE AND REPLACE "return operand()" WITH SOMETHING 
-	// MORE MEANINGFUL
-#endif
-	return operand();
+	for (int i = formals->first(); formals->more(i); i = formals->next(i))
+		env->add_local(formals->nth(i)->get_name(), NULL);
+	env->assigned.clear();
+	expr = expr->simplify(env);
+	env->propagate = true;
+	expr = expr->simplify(env);
+	env->propagate = false;
+	for (int i = formals->first(); formals->more(i); i = formals->next(i))
+		env->kill_local();
 }
 
-operand new__class::code(CgenEnvironment *env) 
+void attr_class::simplify(SimplifyEnvironment *env)
 {
-	if (cgen_debug) std::cerr << "newClass" << endl;
-#ifndef PA5
-	assert(0 && "Unsupported case for phase 1");
-#else
-	// ADD CODE HERE AND REPLACE "return operand()" WITH SOMETHING 
-	// MORE MEANINGFUL
-#endif
-	return operand();
+	env->assigned.clear();
+	init = init->simplify(env);
+	env->propagate = true;
+	init = init->simplify(env);
+	env->propagate = false;
 }
 
-operand isvoid_class::code(CgenEnvironment *env) 
+void branch_class::simplify(SimplifyEnvironment *env)
 {
-	if (cgen_debug) std::cerr << "isvoid" << endl;
-#ifndef PA5
-	assert(0 && "Unsupported case for phase 1");
-#else
-	// ADD CODE HERE AND REPLACE "return operand()" WITH SOMETHING 
-	// MORE MEANINGFUL
-#endif
-	return operand();
+	env->add_local(name, NULL);
+	expr = expr->simplify(env);
+	env->kill_local();
 }
 
-// Create the LLVM Function corresponding to this method.
-void method_class::layout_feature(CgenNode *cls) 
+Expression assign_class::simplify(SimplifyEnvironment *env)
 {
-#ifndef PA5
-	assert(0 && "Unsupported case for phase 1");
-#else
-	// ADD CODE HERE
-#endif
+	expr = expr->simplify(env);
+	env->assigned.insert(name);
+	return this;
 }
 
-// If the source tag is >= the branch tag and <= (max child of the branch class) tag,
-// then the branch is a superclass of the source
-operand branch_class::code(operand expr_val, operand tag,
-				op_type join_type, CgenEnvironment *env) {
-#ifndef PA5
-	assert(0 && "Unsupported case for phase 1");
-#else
-	// ADD CODE HERE AND REPLACE "return operand()" WITH SOMETHING 
-	// MORE MEANINGFUL
-#endif
-	return operand();
+Expression static_dispatch_class::simplify(SimplifyEnvironment *env)
+{
+	expr = expr->simplify(env);
+	actual = simplify_all(actual, env);
+	return this;
 }
 
-// Assign this attribute a slot in the class structure
-void attr_class::layout_feature(CgenNode *cls)
+Expression dispatch_class::simplify(SimplifyEnvironment *env)
 {
-#ifndef PA5
-	assert(0 && "Unsupported case for phase 1");
-#else
-	// ADD CODE HERE
-#endif
+	expr = expr->simplify(env);
+	actual = simplify_all(actual, env);
+	return this;
 }
 
-void attr_class::code(CgenEnvironment *env)
+// Only the arm that can run is kept when the predicate is constant
+Expression cond_class::simplify(SimplifyEnvironment *env)
 {
-#ifndef PA5
-	assert(0 && "Unsupported case for phase 1");
-#else
-	// ADD CODE HERE
-#endif
+	pred = pred->simplify(env);
+	bool b;
+	if (pred->get_bool_const(b)) {
+		env->num_simplified++;
+		Expression arm = b ? then_exp->simplify(env) : else_exp->simplify(env);
+		return with_type(arm, type, this);
+	}
+	then_exp = then_exp->simplify(env);
+	else_exp = else_exp->simplify(env);
+	return this;
+}
+
+// A loop that never runs is left in place; the enclosing block drops
+// it unless it is the block's value
+Expression loop_class::simplify(SimplifyEnvironment *env)
+{
+	pred = pred->simplify(env);
+	body = body->simplify(env);
+	return this;
+}
+
+Expression typcase_class::simplify(SimplifyEnvironment *env)
+{
+	expr = expr->simplify(env);
+	for (int i = cases->first(); cases->more(i); i = cases->next(i))
+		cases->nth(i)->simplify(env);
+	return this;
 }
 
+// Statements without side effects are dropped unless they give the
+// block its value
+Expression block_class::simplify(SimplifyEnvironment *env)
+{
+	Expressions out = nil_Expressions();
+	int last = body->len() - 1, n = 0;
+	for (int i = body->first(); body->more(i); i = body->next(i)) {
+		Expression e = body->nth(i)->simplify(env);
+		if (i != last && e->is_pure()) {
+			env->num_simplified++;
+			continue;
+		}
+		out = append_Expressions(out, single_Expressions(e));
+		n++;
+	}
+	if (n == 1 && out->nth(out->first())->get_type() == type)
+		return out->nth(out->first());
+	body = out;
+	return this;
+}
+
+// An Int or Bool let bound to a constant and never assigned is replaced
+// by its body, with the constant substituted for the variable
+Expression let_class::simplify(SimplifyEnvironment *env)
+{
+	init = init->simplify(env);
+	int iv;
+	bool bv;
+	bool is_const = (type_decl == Int && init->get_int_const(iv))
+		|| (type_decl == Bool && init->get_bool_const(bv));
+	if (env->propagate && is_const && !env->is_assigned(identifier)) {
+		env->add_local(identifier, init);
+		Expression e = body->simplify(env);
+		env->kill_local();
+		env->num_simplified++;
+		return e;
+	}
+	env->add_local(identifier, NULL);
+	body = body->simplify(env);
+	env->kill_local();
+	return this;
+}
+
+Expression plus_class::simplify(SimplifyEnvironment *env)
+{
+	e1 = e1->simplify(env);
+	e2 = e2->simplify(env);
+	int a, b;
+	if (e1->get_int_const(a) && e2->get_int_const(b)) {
+		env->num_simplified++;
+		return make_int((int)((unsigned)a + (unsigned)b), this);
+	}
+	if (is_int(e2, 0) || is_int(e1, 0)) {
+		env->num_simplified++;
+		return is_int(e2, 0) ? e1 : e2;
+	}
+	return this;
+}
+
+Expression sub_class::simplify(SimplifyEnvironment *env)
+{
+	e1 = e1->simplify(env);
+	e2 = e2->simplify(env);
+	int a, b;
+	if (e1->get_int_const(a) && e2->get_int_const(b)) {
+		env->num_simplified++;
+		return make_int((int)((unsigned)a - (unsigned)b), this);
+	}
+	if (is_int(e2, 0)) {
+		env->num_simplified++;
+		return e1;
+	}
+	return this;
+}
+
+// x * 0 only folds when x has no side effects
+Expression mul_class::simplify(SimplifyEnvironment *env)
+{
+	e1 = e1->simplify(env);
+	e2 = e2->simplify(env);
+	int a, b;
+	if (e1->get_int_const(a) && e2->get_int_const(b)) {
+		env->num_simplified++;
+		return make_int((int)((unsigned)a * (unsigned)b), this);
+	}
+	if (is_int(e2, 1) || is_int(e1, 1)) {
+		env->num_simplified++;
+		return is_int(e2, 1) ? e1 : e2;
+	}
+	if ((is_int(e2, 0) && e1->is_pure()) || (is_int(e1, 0) && e2->is_pure())) {
+		env->num_simplified++;
+		return make_int(0, this);
+	}
+	return this;
+}
+
+// Division by zero and INT_MIN / -1 are left for run time
+Expression divide_class::simplify(SimplifyEnvironment *env)
+{
+	e1 = e1->simplify(env);
+	e2 = e2->simplify(env);
+	int a, b;
+	// INT_MIN / -1 wraps around to INT_MIN
+	if (e1->get_int_const(a) && e2->get_int_const(b) && b != 0) {
+		env->num_simplified++;
+		return make_int(b == -1 ? (int)(0u - (unsigned)a) : a / b, this);
+	}
+	if (is_int(e2, 1)) {
+		env->num_simplified++;
+		return e1;
+	}
+	return this;
+}
+
+Expression neg_class::simplify(SimplifyEnvironment *env)
+{
+	e1 = e1->simplify(env);
+	int a;
+	if (e1->get_int_const(a)) {
+		env->num_simplified++;
+		return make_int((int)(0u - (unsigned)a), this);
+	}
+	if (e1->get_neg_operand()) {
+		env->num_simplified++;
+		return e1->get_neg_operand();
+	}
+	return this;
+}
+
+Expression lt_class::simplify(SimplifyEnvironment *env)
+{
+	e1 = e1->simplify(env);
+	e2 = e2->simplify(env);
+	int a, b;
+	if (e1->get_int_const(a) && e2->get_int_const(b)) {
+		env->num_simplified++;
+		return make_bool(a < b, this);
+	}
+	return this;
+}
+
+Expression eq_class::simplify(SimplifyEnvironment *env)
+{
+	e1 = e1->simplify(env);
+	e2 = e2->simplify(env);
+	int a, b;
+	bool p, q;
+	if (e1->get_int_const(a) && e2->get_int_const(b)) {
+		env->num_simplified++;
+		return make_bool(a == b, this);
+	}
+	if (e1->get_bool_const(p) && e2->get_bool_const(q)) {
+		env->num_simplified++;
+		return make_bool(p == q, this);
+	}
+	// Literals are interned: equal ones are the same Symbol
+	Symbol s, t;
+	if (e1->get_string_const(s) && e2->get_string_const(t)) {
+		env->num_simplified++;
+		return make_bool(s == t, this);
+	}
+	return this;
+}
+
+Expression leq_class::simplify(SimplifyEnvironment *env)
+{
+	e1 = e1->simplify(env);
+	e2 = e2->simplify(env);
+	int a, b;
+	if (e1->get_int_const(a) && e2->get_int_const(b)) {
+		env->num_simplified++;
+		return make_bool(a <= b, this);
+	}
+	return this;
+}
+
+Expression comp_class::simplify(SimplifyEnvironment *env)
+{
+	e1 = e1->simplify(env);
+	bool b;
+	if (e1->get_bool_const(b)) {
+		env->num_simplified++;
+		return make_bool(!b, this);
+	}
+	if (e1->get_not_operand()) {
+		env->num_simplified++;
+		return e1->get_not_operand();
+	}
+	return this;
+}
+
+Expression int_const_class::simplify(SimplifyEnvironment *env) { return this; }
+
+Expression bool_const_class::simplify(SimplifyEnvironment *env) { return this; }
+
+Expression string_const_class::simplify(SimplifyEnvironment *env) { return this; }
+
+Expression new__class::simplify(SimplifyEnvironment *env) { return this; }
+
+Expression isvoid_class::simplify(SimplifyEnvironment *env)
+{
+	e1 = e1->simplify(env);
+	return this;
+}
+
+Expression no_expr_class::simplify(SimplifyEnvironment *env) { return this; }
+
+Expression object_class::simplify(SimplifyEnvironment *env)
+{
+	Expression c = env->propagate ? env->lookup(name) : NULL;
+	int iv;
+	bool bv;
+	if (c) {
+		// Each use gets its own node
+		env->num_simplified++;
+		if (c->get_int_const(iv))
+			return make_int(iv, this);
+		c->get_bool_const(bv);
+		return make_bool(bv, this);
+	}
+	return this;
+}
@@ -9,13 +9,95 @@
 //
 
 // ------------------ INSERT DESIGN DOCUMENTATION HERE --------------------- //
-
-
+//
+// Passes.  CgenClassTable::setup runs, in this order:
+//   1. simplify: constant folding, dead statement removal and propagation
+//      of constant Int/Bool lets.  A replacement never narrows the static
+//      type of the expression it replaces (a narrower one is wrapped in a
+//      block of the old type), and no node is shared between two places.
+//   2. reachability (PA5): from Main.main and the classes the runtime
+//      creates, marks the instantiated classes, the reached initializers
+//      and the live methods.  A dispatch reaches a method in every
+//      instantiated subclass of the static type.  Dead methods keep their
+//      vtable slot, filled with dead_method; dead attributes get no slot,
+//      so this runs before layout.
+//   3. escape analysis (PA5, without GC only): allocation sites whose
+//      object never leaves the method, is not in a loop, and whose
+//      initializers do not leak self get a stack slot.  The collector
+//      moves objects, so with -g or -semispace every object is on the heap.
+//   4. setup_classes: tags, attribute and vtable layout, in tree preorder.
+//   5. TBAA (PA5): one scalar node per attribute slot, keyed on the class
+//      that declares it, plus one for the vtable pointer and one for the
+//      contents of vtables.
+// code_module then emits the class and vtable types, the constants, the
+// error stubs, main and the classes.  With -j N the classes are generated
+// on N threads, each into its own buffer, and the buffers are written in
+// tree order.  Fresh names restart for each class and the counter is per
+// thread, so the output does not depend on the schedule.  Everything the
+// classes share is built in setup() and only read afterwards, except the
+// intern tables in operand.cc.
+//
+// Classes.  Tags are given in preorder, so the subclasses of C are
+// exactly the tags C.tag .. C.max_child; case and the basic tags in
+// coolrt.h (Object 0, Int 1, Bool 2, String 3, IO 4) rely on this.  An
+// object is { vtable*, attributes... }; a vtable is { tag, size, name,
+// gc_map, new, methods... }, and a subclass vtable has its parent's as a
+// prefix.  Each slot has the type of the method's first definition, and
+// overrides are cast to it.  A call whose receiver class has no live
+// override is direct; others load the slot.  Every object starts as a
+// memcpy of its class's constant prototype, which holds the vtable
+// pointer and every attribute whose initializer is a constant; _init runs
+// the rest, or they are generated inline for a stack object.
+//
+// Values.  Int and Bool are unboxed (i32, i1) while their static type is
+// Int or Bool, and boxed by conform when they flow into another type.
+// Ints in SMALL_INT_MIN..SMALL_INT_MAX and both Bools have static boxes.
+// = compares unboxed values directly and Strings by content; when both
+// static types are Object it checks the dynamic tags and compares Int,
+// Bool and String boxes by value.  Any other class compares by identity.
+//
+// Metadata.  The vtable pointer of an object is written once, by the
+// prototype memcpy, the box store or the runtime, before the object is
+// seen, so its loads carry !invariant.group.  Vtables are constants, so
+// loads from them carry !invariant.load.  Attribute loads and stores
+// carry the TBAA tag of their slot.
+//
+// GC roots.  With -g or -semispace, methods use the shadow-stack
+// strategy: every object slot in the frame is an llvm.gcroot, cleared
+// when the frame is opened.  A value that must survive a call that may
+// allocate is spilled to a root and reloaded after it, so no object
+// pointer is held in a register across a collection.  Attribute stores
+// under -g go through the card-marking write barrier.
+//
 // ----------------------------- END DESIGN DOCS --------------------------- //
 
 #include "cool-tree.h"
 #include "symtab.h"
 #include "value_printer.h"
+#include "ir_sink.h"
+#include <map>
+#include <set>
+#include <utility>
+
+//
+// Interprocedural escape summary of one method: which of self and the
+// formals may escape through it, and which of them it may return.
+//
+struct EscapeSummary
+{
+	bool self_escapes;
+	bool returns_self;
+	vector<bool> param_escapes;
+	vector<bool> returns_param;
+
+	EscapeSummary() : self_escapes(false), returns_self(false) { }
+	bool operator==(const EscapeSummary &o) const
+	{
+		return self_escapes == o.self_escapes && returns_self == o.returns_self
+			&& param_escapes == o.param_escapes 
+			&& returns_param == o.returns_param;
+	}
+};
 
 //
 // CgenClassTable represents the top level of a Cool program, which is
@@ -56,8 +138,27 @@ private:
 
 #ifdef PA5
 	void code_classes(CgenNode *c);
+	void list_classes(CgenNode *c, std::vector<CgenNode*> &order);
+	void report_removed_features(CgenNode *c);
+	void code_dead_method_stub();
+	void code_heap_alloc();
 #endif
 
+	// Whole-program reachability from Main.main.  Dispatch edges are
+	// resolved with rapid type analysis: a call site only reaches the
+	// overrides in classes that are actually instantiated somewhere.
+	void compute_reachability();
+
+	// Escape analysis over every live method, iterated with the
+	// interprocedural summaries until nothing changes.  Allocation sites
+	// whose object never outlives the method are recorded as stack sites.
+	void compute_escapes();
+	bool escape_pass(CgenNode *c);
+
+	// Constant folding and algebraic simplification of the AST.  Runs
+	// before the other analyses so that they never see folded-away code.
+	void simplify_classes(CgenNode *c, SimplifyEnvironment *env);
+
 	// The following creates an inheritance graph from a list of classes.  
 	// The graph is implemented as a tree of `CgenNode', and class names 
 	// are placed in the base class symbol table.
@@ -72,7 +173,63 @@ private:
     
 	// Setup each class in the table and prepare for code generation phase
 	void setup();
-    
+
+	// Reachability state: every class instantiated so far, every
+	// (static class, method) dispatch site seen so far, and the live
+	// methods whose bodies have not been walked yet.
+	std::vector<CgenNode*> reach_classes;
+	std::set<std::pair<CgenNode*,Symbol> > reach_sites;
+	std::vector<std::pair<CgenNode*,Feature> > reach_worklist;
+	int removed_methods;
+	int removed_attrs;
+
+	// Escape analysis state
+	std::map<Feature,EscapeSummary> escape_summaries;
+	std::set<CgenNode*> escaping_inits;   // initializers leak self
+	std::set<new__class*> stack_sites;
+	std::set<Feature> frame_methods;      // methods with stack sites
+	int num_alloc_sites;
+
+	// TBAA metadata: a scalar type node and an access tag per attribute
+	// slot, so that stores to one field never clobber loads of another.
+	// !0 is the empty node, !1 the TBAA root and !2 the weights of an
+	// unlikely branch; the node for tbaa_names[i] is !(3 + 2*i) and its
+	// access tag the next one.
+	std::vector<string> tbaa_names;
+	std::map<attr_class*,int> tbaa_tags;
+	int add_tbaa_node(string name);
+	void setup_tbaa(CgenNode *c);
+	void code_metadata();
+
+	// Source files of the classes, numbered for the runtime error stubs
+	std::vector<Symbol> source_files;
+	void code_error_stubs();
+
+public:
+	// Edges recorded while walking live code
+	void reach_instantiate(CgenNode *c);
+	void reach_dispatch(CgenNode *static_cls, Symbol name);
+	void reach_method(CgenNode *c, Symbol name);
+
+	// Summary of the definition of name visible in class c
+	EscapeSummary get_escape_summary(CgenNode *c, Symbol name);
+	bool init_leaks_self(CgenNode *c) { return escaping_inits.count(c) != 0; }
+	bool is_stack_site(new__class *site) { return stack_sites.count(site) != 0; }
+	bool has_stack_objects(Feature m) { return frame_methods.count(m) != 0; }
+
+	// TBAA access tags
+	// Field 0 of every object.  It is written exactly once per object,
+	// before the object is seen: by the memcpy from the prototype, by
+	// code_box_alloc, or by the runtime.  Its loads may then carry
+	// !invariant.group; the write carries none, as a memcpy cannot.
+	int vtable_ptr_tbaa;
+	int vtable_tbaa;         // the contents of vtables
+	int get_attr_tbaa(attr_class *a)
+		{ std::map<attr_class*,int>::iterator i = tbaa_tags.find(a);
+		  return i == tbaa_tags.end() ? 0 : i->second; }
+	int get_file_index(Symbol file);
+
+private:
 	// Code generation functions. You need to write these functions.
 	void code_module();
 	void code_constants();
@@ -111,6 +268,23 @@ private:
 
 
 	// ADD CODE HERE
+	// Reachability from Main.main
+	bool instantiated;                 // some `new' may create this class
+	bool init_reached;                 // attribute initializers walked
+	std::set<Symbol> live_methods;     // methods of this class that may run
+	std::set<Symbol> read_attrs;       // attributes of this class ever read
+
+#ifdef PA5
+	// Layout, inherited slots first.  A vtable slot records the method
+	// name and the class whose definition fills it.
+	vector<Symbol> vtable_names;
+	vector<CgenNode*> vtable_impls;
+	vector<attr_class*> attr_slots;
+	// Attributes, here or inherited, whose value is already in the
+	// prototype object; _init is only needed for the others
+	std::set<attr_class*> proto_attrs;
+	bool init_code;
+#endif
 
 
 public:
@@ -122,6 +296,7 @@ public:
 	void set_parentnd(CgenNode *p);
 	int basic() { return (basic_status == Basic); }
 	List<CgenNode> *get_children() { return children; }
+	Features get_features() { return features; }
     
 	// Accessors for other provided fields
 	int get_tag() const 	{ return tag; }
@@ -140,11 +315,65 @@ public:
 	void setup(int tag, int depth);
 
 	// Class codegen. You need to write the body of this function.
-	void code_class();
+	void code_class(std::ostream &s);
 
 	// ADD CODE HERE
 	string get_type_name() { return string(name->get_string()); }
 
+	// LLVM type of a value whose static Cool type is t, seen from code
+	// in this class.  Int and Bool are kept unboxed (i32 and i1); every
+	// other class is a pointer to its object struct.
+	op_type value_type(Symbol t);
+
+	// Features defined directly in this class, and the nearest class
+	// (this one or an ancestor) defining the given method or attribute
+	Feature get_feature(Symbol name, bool method);
+	CgenNode *lookup_method(Symbol name);
+	CgenNode *lookup_attr(Symbol name);
+	bool is_subclass_of(CgenNode *c);
+	// Some live subclass definition replaces method m of this class
+	bool has_live_override(Symbol m);
+	// The ancestor (or this class) whose definition of m overrides none
+	CgenNode *method_root(Symbol m);
+	// Calling convention of the function for method m of this class
+	call_conv method_cc(Symbol m);
+
+	bool is_instantiated() const	{ return instantiated; }
+	void set_instantiated()		{ instantiated = true; }
+	bool is_init_reached() const	{ return init_reached; }
+	void set_init_reached()		{ init_reached = true; }
+	// Returns true the first time a method is marked live
+	bool mark_method_live(Symbol m)	{ return live_methods.insert(m).second; }
+	bool is_method_live(Symbol m)	{ return basic() || live_methods.count(m); }
+	void mark_attr_read(Symbol a)	{ read_attrs.insert(a); }
+	bool is_attr_live(Symbol a)	{ return basic() || read_attrs.count(a); }
+
+#ifdef PA5
+	void add_method(Symbol m);
+	void add_attribute(attr_class *a);
+	int get_num_methods() const	{ return vtable_names.size(); }
+	int get_num_attrs() const	{ return attr_slots.size(); }
+	op_type get_attr_type(int i)
+		{ return value_type(attr_slots[i]->get_type_decl()); }
+	attr_class *get_attr(int i)	{ return attr_slots[i]; }
+	// Slot of attribute a, -1 if it has none
+	int get_attr_index(Symbol a);
+	int get_attr_tbaa(int i)
+		{ return class_table->get_attr_tbaa(attr_slots[i]); }
+	// Function filling vtable slot i; dead methods share one trap stub
+	string get_slot_function(int i);
+	// Object and vtable types
+	void code_types(std::ostream &s);
+	// Slot of method m, and the type of slot i
+	int get_method_index(Symbol m);
+	op_func_type get_slot_type(int i);
+	// Function type of this class's definition of m
+	op_func_type method_type(Symbol m);
+	bool in_prototype(attr_class *a) { return proto_attrs.count(a) != 0; }
+	// Some initializer must run after the prototype is copied
+	bool needs_init() const		{ return init_code; }
+#endif
+
 
 private:
 	// Layout the methods and attributes for code generation
@@ -152,6 +381,16 @@ private:
 	void layout_features();
 
 	// ADD CODE HERE
+#ifdef PA5
+	// The vtable of an instantiated class
+	void code_vtable(std::ostream &s, const_value gc_map);
+	// Offsets of the pointer attributes, for the collector (-g)
+	const_value code_gc_map(std::ostream &s);
+	// The constant every new object of the class starts as, and _new
+	void code_prototype(std::ostream &s);
+	void code_new(std::ostream &s);
+	void code_init(std::ostream &s);
+#endif
 
 };
 
@@ -169,6 +408,16 @@ private:
 	// mapping from variable names to memory locations
 	cool::SymbolTable<Symbol,operand> var_table;
 
+	// Frame of the current method.  The body is generated into body
+	// while every slot it asks for is emitted into frame; close_frame
+	// then writes the frame at the top of the entry block, so no alloca
+	// ends up inside a loop.  Slots of scopes that have ended are kept
+	// by type and handed to later scopes.
+	IRSink frame_buf, body_buf;
+	std::ostream frame, body;
+	std::ostream *method_stream;
+	std::map<string, vector<operand> > free_slots;
+
 	// Keep counters for unique name generation in the current method
 	int block_count;
 	int tmp_count;
@@ -176,6 +425,9 @@ private:
 
 	// ADD CODE HERE
 	CgenNode *cur_class;
+	// Scopes and classes hidden by begin_object
+	vector<cool::SymbolTable<Symbol,operand> > outer_vars;
+	vector<CgenNode*> outer_classes;
 
 
 public:
@@ -193,10 +445,38 @@ public:
 	void kill_local();
 	// end of helpers for provided code
 
+	// The initializers of an object in the frame are generated inline,
+	// as code of its class c with only self in scope
+	void begin_object(CgenNode *c, operand &self_slot);
+	void end_object();
+
 	CgenEnvironment(ostream &strea, CgenNode *cur_class);
 
 
 	operand *lookup(Symbol name)	{ return var_table.lookup(name); }
+
+	// Call open_frame after the function's entry label and close_frame
+	// after its last instruction
+	void open_frame();
+	void close_frame();
+	operand alloc_slot(op_type type);
+	void free_slot(operand slot);
+
+	// With the collector (-g) every object slot is a root, and an
+	// object value that must survive the evaluation of something else
+	// is spilled to a slot meanwhile: spill returns the slot, unspill
+	// loads the value back and frees it.  Other values pass through.
+	operand spill(operand v);
+	operand unspill(operand v);
+
+	// Calls in tail position in the current method.  Self tail calls
+	// store the parameter slots (self first) and jump to tail_label; the
+	// others are tail calls unless objects live in the method's frame.
+	std::set<Expression> self_tail_calls;
+	std::set<Expression> tail_calls;
+	vector<operand> params;
+	string tail_label;
+	bool may_tail;
     
 	CgenNode *get_class() { return cur_class; }
 	void set_class(CgenNode *c) { cur_class = c; }
@@ -206,9 +486,112 @@ public:
 	// Must return the CgenNode for a class given the symbol of its name
 	CgenNode *type_to_class(Symbol t);
 	// ADD CODE HERE
+	op_type value_type(Symbol t) { return cur_class->value_type(t); }
 	
 };
 
+//
+// ReachEnvironment is the counterpart of CgenEnvironment for the
+// reachability pass: it walks one live method (or the attribute
+// initializers of one class) and reports instantiations, dispatches and
+// attribute reads to the class table.  Formals, let and case bindings are
+// tracked so that a name which is none of those is known to be an
+// attribute of the current class.
+//
+class ReachEnvironment
+{
+private:
+	cool::SymbolTable<Symbol,Entry> locals;
+	CgenNode *cur_class;
+
+public:
+	ReachEnvironment(CgenNode *cur_class);
+
+	CgenNode *get_class() { return cur_class; }
+	CgenNode *type_to_class(Symbol t);
+
+	void add_local(Symbol name, Symbol type_decl);
+	void kill_local();
+
+	void instantiate(Symbol type);
+	void dispatch(Symbol static_type, Symbol name);
+	void static_dispatch(Symbol type, Symbol name);
+	void read(Symbol name);
+};
+
+//
+// EscapeEnvironment carries the state of the escape analysis of one
+// method (or of the attribute initializers of one class).  Every
+// expression evaluates to an EscapeSet; storing into an attribute,
+// returning, or passing to a formal that escapes in the callee makes
+// the values escape.  Locals are flow-insensitive: whatever is ever
+// stored into a let or case binding escapes with it.
+//
+class EscapeEnvironment
+{
+private:
+	cool::SymbolTable<Symbol,tree_node> locals;
+	CgenNode *cur_class;
+	tree_node *self_token;
+	std::map<tree_node*,EscapeSet> stored;
+	EscapeSet escaped;
+	int loop_depth;
+
+	EscapeSet closure(EscapeSet v);
+
+public:
+	// Allocation sites in this method, and those inside a loop
+	vector<new__class*> sites;
+	std::set<new__class*> loop_sites;
+
+	EscapeEnvironment(CgenNode *cur_class, tree_node *self_token);
+
+	CgenNode *get_class() { return cur_class; }
+	CgenNode *type_to_class(Symbol t);
+
+	void add_local(Symbol name, tree_node *binding, EscapeSet init);
+	void kill_local();
+	EscapeSet lookup(Symbol name);
+	void assign(Symbol name, EscapeSet v);
+	void escape(EscapeSet v) { escaped.insert(v.begin(), v.end()); }
+
+	void enter_loop() { loop_depth++; }
+	void exit_loop() { loop_depth--; }
+	EscapeSet alloc(new__class *site);
+
+	// Apply the summaries of every possible target of a dispatch
+	EscapeSet dispatch(CgenNode *static_cls, Symbol name, bool is_static,
+		EscapeSet recv, vector<EscapeSet> &args);
+
+	// Finish the method: compute its summary from the returned values
+	EscapeSummary summary;
+	void summarize(EscapeSet ret, vector<tree_node*> &formals);
+	bool self_escaped() { return closure(escaped).count(self_token) != 0; }
+	bool has_escaped(new__class *site);
+};
+
+// Simplification walks each feature twice: the first pass folds
+// constants and records every assigned name, the second also replaces
+// uses of let variables that are bound to a constant and never assigned.
+class SimplifyEnvironment
+{
+private:
+	// Constant value of each let variable in scope, NULL if not constant
+	cool::SymbolTable<Symbol,Expression_class> consts;
+
+public:
+	bool propagate;
+	std::set<Symbol> assigned;
+	int num_simplified;
+
+	SimplifyEnvironment();
+
+	void add_local(Symbol name, Expression value);
+	void kill_local();
+	Expression lookup(Symbol name) { return consts.lookup(name); }
+	bool is_assigned(Symbol name) { return assigned.count(name) != 0; }
+};
+
 // Utitlity function
 // Generate any code necessary to convert from given operand to
 // dest_type, assuing it has already been checked to be compatible
@@ -5,6 +5,7 @@
 #define COOL_TREE_HANDCODE_H
 
 #include <iostream>
+#include <set>
 #include <string>
 #include "tree.h"
 #include "cool.h"
@@ -15,6 +16,14 @@
 using std::string;
 
 class CgenEnvironment;
+class ReachEnvironment;
+class EscapeEnvironment;
+class SimplifyEnvironment;
+class CgenNode;
+
+// Abstract value of the escape analysis: the allocation sites, local
+// bindings, formals and self an expression may evaluate to
+typedef std::set<tree_node *> EscapeSet;
 
 #define yylineno curr_lineno;
 extern int yylineno;
@@ -77,19 +86,36 @@ void dump_with_types(ostream&,int);
 
 
 #define Feature_EXTRAS                     		\
+virtual Symbol get_name() = 0;				\
+virtual int is_method() = 0;				\
 virtual void dump_with_types(ostream&,int) = 0; 	\
 virtual void layout_feature(CgenNode *cls) = 0;		\
-virtual void code(CgenEnvironment *env) = 0;
+virtual void code(CgenEnvironment *env) = 0;		\
+virtual void reach(ReachEnvironment *env) = 0;		\
+virtual void escape(EscapeEnvironment *env) = 0;	\
+virtual void simplify(SimplifyEnvironment *env) = 0;
 
 
 #define Feature_SHARED_EXTRAS                           \
+Symbol get_name() { return name; }			\
 void dump_with_types(ostream&,int);  			\
 void layout_feature(CgenNode *cls);			\
-void code(CgenEnvironment *env);
+void code(CgenEnvironment *env);			\
+void reach(ReachEnvironment *env);			\
+void escape(EscapeEnvironment *env);			\
+void simplify(SimplifyEnvironment *env);
 
 
 #define method_EXTRAS			\
-virtual Symbol get_return_type() { return return_type; }
+virtual Symbol get_return_type() { return return_type; }	\
+int is_method() { return 1; }					\
+Formals get_formals() { return formals; }			\
+bool has_self_tail_call(CgenNode *cls);
+
+#define attr_EXTRAS			\
+Symbol get_type_decl() { return type_decl; }	\
+Expression get_init() { return init; }	\
+int is_method() { return 0; }
 
 #define Formal_EXTRAS                              \
 virtual Symbol get_type_decl() = 0;                /* ## */ \
@@ -105,8 +131,12 @@ void dump_with_types(ostream&,int);
 
 #define Case_EXTRAS                             \
 virtual Symbol get_type_decl() = 0; 		\
+virtual Expression get_expr() = 0;		\
 virtual operand code(operand, operand, const op_type,  \
 	CgenEnvironment *) = 0;	\
+virtual void reach(ReachEnvironment *) = 0;	\
+virtual EscapeSet escape(EscapeSet, EscapeEnvironment *) = 0;	\
+virtual void simplify(SimplifyEnvironment *) = 0;	\
 virtual void dump_with_types(ostream& ,int) = 0;
 
 
@@ -115,6 +145,9 @@ Symbol get_type_decl() { return type_decl; } 			\
 Expression get_expr() { return expr; }		\
 operand code(operand expr_val, operand tag, 	\
 	const op_type join_type, CgenEnvironment *env); 	\
+void reach(ReachEnvironment *env);		\
+EscapeSet escape(EscapeSet expr_val, EscapeEnvironment *env);	\
+void simplify(SimplifyEnvironment *env);	\
 void dump_with_types(ostream& ,int);
 
 
@@ -123,16 +156,88 @@ Symbol type;                                 \
 Symbol get_type() { return type; }           \
 Expression set_type(Symbol s) { type = s; return this; } \
 virtual int no_code() { return 0; }          /* ## */ \
+virtual bool get_int_const(int &v) { return false; } \
+virtual bool get_bool_const(bool &b) { return false; } \
+virtual bool get_string_const(Symbol &s) { return false; } \
+virtual Expression get_not_operand() { return NULL; } \
+virtual Expression get_neg_operand() { return NULL; } \
+virtual bool is_pure() { return false; }     \
+virtual bool is_self() { return false; }     \
+virtual void find_tail_calls(std::vector<Expression> &calls) { } \
+virtual bool is_self_recursion(CgenNode *cls, Symbol method) { return false; } \
 virtual void dump_with_types(ostream&,int) = 0;  \
 virtual operand code(CgenEnvironment *)=0;	   \
+virtual void reach(ReachEnvironment *)=0;	   \
+virtual EscapeSet escape(EscapeEnvironment *)=0;   \
+virtual Expression simplify(SimplifyEnvironment *)=0; \
 void dump_type(ostream&, int);               \
 Expression_class() { type = (Symbol) NULL; }
 
 #define Expression_SHARED_EXTRAS           \
 operand code(CgenEnvironment *);	   \
+void reach(ReachEnvironment *);		   \
+EscapeSet escape(EscapeEnvironment *);	   \
+Expression simplify(SimplifyEnvironment *); \
 void dump_with_types(ostream&,int); 
 
+#define new__EXTRAS                     \
+Symbol get_type_name() { return type_name; }
+
 #define no_expr_EXTRAS        /* ## */ \
-int no_code() { return 1; }   /* ## */
+int no_code() { return 1; }   /* ## */ \
+bool is_pure() { return true; }
+
+#define int_const_EXTRAS                        \
+bool get_int_const(int &v) { v = atoi(token->get_string()); return true; } \
+bool is_pure() { return true; }
+
+#define bool_const_EXTRAS                       \
+bool get_bool_const(bool &b) { b = val; return true; } \
+bool is_pure() { return true; }
+
+#define string_const_EXTRAS                     \
+bool get_string_const(Symbol &s) { s = token; return true; } \
+bool is_pure() { return true; }
+
+#define object_EXTRAS                           \
+bool is_pure() { return true; }                 \
+bool is_self();
+
+#define comp_EXTRAS                             \
+Expression get_not_operand() { return e1; }
+
+#define neg_EXTRAS                              \
+Expression get_neg_operand() { return e1; }
+
+/* Calls in tail position: the value of the expression is the value of
+   the method.  Self tail calls become jumps, the others tail calls. */
+#define cond_EXTRAS                             \
+void find_tail_calls(std::vector<Expression> &calls) \
+  { then_exp->find_tail_calls(calls); else_exp->find_tail_calls(calls); }
+
+#define block_EXTRAS                            \
+void find_tail_calls(std::vector<Expression> &calls) \
+  { body->nth(body->len() - 1)->find_tail_calls(calls); }
+
+#define let_EXTRAS                              \
+void find_tail_calls(std::vector<Expression> &calls) \
+  { body->find_tail_calls(calls); }
+
+#define typcase_EXTRAS                          \
+void find_tail_calls(std::vector<Expression> &calls) \
+  { for (int i = cases->first(); cases->more(i); i = cases->next(i)) \
+      cases->nth(i)->get_expr()->find_tail_calls(calls); }
+
+#define dispatch_EXTRAS                         \
+void find_tail_calls(std::vector<Expression> &calls) { calls.push_back(this); } \
+bool is_self_recursion(CgenNode *cls, Symbol method);
+
+#define static_dispatch_EXTRAS                  \
+void find_tail_calls(std::vector<Expression> &calls) { calls.push_back(this); } \
+bool is_self_recursion(CgenNode *cls, Symbol method);
+
+/* A loop whose predicate folded to false never runs its body */
+#define loop_EXTRAS                             \
+bool is_pure() { bool b; return pred->get_bool_const(b) && !b; }
 
 #endif /* COOL_TREE_HANDCODE_H */
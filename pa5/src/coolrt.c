@@ -3,6 +3,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#include <time.h>
+#include <stddef.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
 
 /* This file provides the runtime library for cool. It implements
    the functions of the cool classes in C 
@@ -17,12 +26,833 @@ const char IO_string[] 		= "IO";
 
 const char default_string[]	= "";
 
+/* Pointer maps, see coolrt.h */
+static const int no_pointers[] = { 0 };
+static const int String_pointers[] = { 3, -(int) offsetof(String, val),
+	offsetof(String, left), offsetof(String, right) };
+
 /* Class vtable prototypes */
 const Object_vtable Object_vtable_prototype = {
 	/* ADD CODE HERE */
+	0, sizeof(Object), Object_string, no_pointers,
+	Object_new, Object_abort, Object_type_name, Object_copy
 };
 
 /* ADD CODE HERE FOR MORE VTABLE PROTOTYPES */
+const Int_vtable Int_vtable_prototype = {
+	1, sizeof(Int), Int_string, no_pointers,
+	Int_new, Object_abort, Object_type_name, (Int* (*)(Int*)) Object_copy
+};
+
+const Bool_vtable Bool_vtable_prototype = {
+	2, sizeof(Bool), Bool_string, no_pointers,
+	Bool_new, Object_abort, Object_type_name, (Bool* (*)(Bool*)) Object_copy
+};
+
+const String_vtable String_vtable_prototype = {
+	3, sizeof(String), String_string, String_pointers,
+	String_new, Object_abort, Object_type_name, 
+	(String* (*)(String*)) Object_copy,
+	String_length, String_concat, String_substr
+};
+
+const IO_vtable IO_vtable_prototype = {
+	4, sizeof(IO), IO_string, no_pointers,
+	IO_new, Object_abort, Object_type_name, (IO* (*)(IO*)) Object_copy,
+	IO_out_string, IO_out_int, IO_in_string, IO_in_int
+};
+
+/* Report a runtime error in the format of the reference implementation */
+static void runtime_error(const char *msg)
+{
+	fprintf(stderr, "%s\n", msg);
+	exit(1);
+}
+
+
+/*
+// Runtime heap, see coolrt.h
+*/
+__thread char *cool_heap_ptr;
+__thread char *cool_heap_limit;
+static __thread char *heap_chunk;
+
+static size_t heap_chunk_size;
+static bool heap_hugepages;
+
+/* Usage for COOL_HEAP_STATS.  Cool programs run on one thread, so these
+   are not kept per thread. */
+static size_t heap_chunks, heap_retired_bytes;
+static size_t heap_large, heap_large_bytes;
+
+/* Overridden by the definition cgen -g emits */
+int cool_gc_flags __attribute__((weak)) = 0;
+
+static double heap_start_ms;
+
+static void gc_init(void);
+static void gc_report(void);
+static void *gc_alloc_slow(int size);
+static void semi_init(void);
+static void semi_report(void);
+static void *semi_alloc_slow(int size);
+static size_t heap_allocated(void);
+static double gc_ms(void);
+
+static size_t parse_size(const char *s)
+{
+	char *end;
+	size_t n = strtoul(s, &end, 10);
+	switch (*end) {
+	case 'g': case 'G':
+		n <<= 10;
+		__attribute__((fallthrough));
+	case 'm': case 'M':
+		n <<= 10;
+		__attribute__((fallthrough));
+	case 'k': case 'K':
+		n <<= 10;
+	}
+	return n;
+}
+
+static double now_ms(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/* The same throughput line for every memory manager, to compare them */
+static void heap_report(void)
+{
+	if (cool_gc_flags & COOL_GC_SEMISPACE)
+		semi_report();
+	else if (cool_gc_flags & COOL_GC_ENABLED)
+		gc_report();
+	else {
+		size_t used = heap_retired_bytes + (cool_heap_ptr - heap_chunk);
+		fprintf(stderr, "heap: %zu bytes in %zu chunks of %zu bytes, "
+			"%zu large objects of %zu bytes\n", used, heap_chunks, 
+			heap_chunk_size, heap_large, heap_large_bytes);
+	}
+	double ms = now_ms() - heap_start_ms;
+	size_t bytes = heap_allocated();
+	fprintf(stderr, "heap: %zu bytes allocated in %.3f s, %.1f MB/s, "
+		"%.1f%% of the time collecting\n", bytes, ms / 1e3, 
+		ms > 0 ? bytes / 1e3 / ms : 0.0, ms > 0 ? 100 * gc_ms() / ms : 0.0);
+}
+
+static void heap_init(void)
+{
+	const char *size = getenv("COOL_HEAP_SIZE");
+	heap_chunk_size = size ? parse_size(size) : 8 << 20;
+	if (heap_chunk_size < 64 << 10)
+		heap_chunk_size = 64 << 10;
+	heap_chunk_size = (heap_chunk_size + 4095) & ~(size_t) 4095;
+	heap_hugepages = getenv("COOL_HEAP_HUGEPAGES") != 0;
+	heap_start_ms = now_ms();
+	if (getenv("COOL_HEAP_STATS"))
+		atexit(heap_report);
+	if (cool_gc_flags & COOL_GC_SEMISPACE)
+		semi_init();
+	else if (cool_gc_flags & COOL_GC_ENABLED)
+		gc_init();
+}
+
+static char *heap_map(size_t size)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		runtime_error("out of memory");
+#ifdef MADV_HUGEPAGE
+	if (heap_hugepages)
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+	return p;
+}
+
+void *cool_alloc_slow(int size)
+{
+	if (!heap_chunk_size)
+		heap_init();
+	size = (size + 7) & ~7;
+	if (cool_gc_flags & COOL_GC_SEMISPACE)
+		return semi_alloc_slow(size);
+	if (cool_gc_flags & COOL_GC_ENABLED)
+		return gc_alloc_slow(size);
+	if ((size_t) size > heap_chunk_size / 4) {
+		heap_large++;
+		heap_large_bytes += size;
+		return heap_map(size);
+	}
+	/* The rest of the current chunk is abandoned */
+	if (heap_chunk)
+		heap_retired_bytes += cool_heap_ptr - heap_chunk;
+	heap_chunk = heap_map(heap_chunk_size);
+	heap_chunks++;
+	cool_heap_ptr = heap_chunk + size;
+	cool_heap_limit = heap_chunk + heap_chunk_size;
+	return heap_chunk;
+}
+
+/* A string body of size bytes, after its header word */
+void *cool_alloc_raw(int size)
+{
+	size = (size + 15) & ~7;
+	uintptr_t *p = cool_alloc(size);
+	*p = ((uintptr_t) size << 1) | 1;
+	return p + 1;
+}
+
+
+/*
+// Garbage collector, see coolrt.h
+//
+// One reservation of COOL_HEAP_MAX bytes holds the old space, growing
+// up from the bottom, and the nursery at the top.  Side tables cover
+// the old space: a card byte per 512 bytes (the whole reservation, so
+// the barrier needs no range check), the block covering the first byte
+// of each card, and for compaction a mark bit per word and the new
+// address of each 256-byte group of words.
+*/
+#define CARD_SHIFT 9
+#define GROUP_SHIFT 8
+/* Roots of runtime frames that point to a string body */
+#define RAW_ROOT ((const void *) 1)
+
+/* LLVM's shadow stack: each function compiled with gc "shadow-stack"
+   links a StackEntry holding its root slots into llvm_gc_root_chain */
+typedef struct FrameMap {
+	int32_t num_roots;
+	int32_t num_meta;
+	const void *meta[];
+} FrameMap;
+
+typedef struct StackEntry {
+	struct StackEntry *next;
+	const FrameMap *map;
+	void *roots[];
+} StackEntry;
+
+StackEntry *llvm_gc_root_chain;
+
+/* Frames pushed by runtime functions that allocate while they hold heap
+   pointers; after an allocation they read the pointers back from roots */
+#define MAX_C_ROOTS 2
+struct c_frame_map {
+	int32_t num_roots;
+	int32_t num_meta;
+	const void *meta[MAX_C_ROOTS];
+};
+
+struct c_frame {
+	StackEntry *next;
+	const FrameMap *map;
+	void *roots[MAX_C_ROOTS];
+};
+
+static const struct c_frame_map one_root = { 1, 1, { NULL } };
+static const struct c_frame_map one_raw_root = { 1, 1, { RAW_ROOT } };
+static const struct c_frame_map two_roots = { 2, 2, { NULL, NULL } };
+
+static void push_roots(struct c_frame *f, const struct c_frame_map *map)
+{
+	f->next = llvm_gc_root_chain;
+	f->map = (const FrameMap *) map;
+	llvm_gc_root_chain = (StackEntry *) f;
+}
+
+static void pop_roots(struct c_frame *f)
+{
+	llvm_gc_root_chain = f->next;
+}
+
+static char *gc_base, *gc_end;
+static char *old_top, *old_end;
+static char *nursery;
+static unsigned char *cards;
+static char **card_first;
+static uint32_t *mark_bits;
+static char **group_addr;
+static size_t gc_threshold;
+
+/* Mark stack of the major collection */
+static char **mark_stack;
+static size_t mark_depth, mark_cap;
+
+static struct {
+	size_t minor, major;
+	double minor_ms, major_ms, max_ms;
+	size_t nursery_bytes, promoted_bytes;
+	size_t major_before, major_after;
+} gc_stats;
+
+static void gc_init(void)
+{
+	const char *max = getenv("COOL_HEAP_MAX");
+	size_t size = max ? parse_size(max) : (size_t) 1 << 30;
+	size = (size + heap_chunk_size - 1) / heap_chunk_size * heap_chunk_size;
+	if (size < 4 * heap_chunk_size)
+		size = 4 * heap_chunk_size;
+	gc_base = heap_map(size);
+	gc_end = gc_base + size;
+	nursery = old_end = gc_end - heap_chunk_size;
+	old_top = gc_base;
+
+	size_t old = old_end - gc_base;
+	cards = (unsigned char *) heap_map(size >> CARD_SHIFT);
+	card_first = (char **) heap_map((old >> CARD_SHIFT) * sizeof(char *));
+	mark_bits = (uint32_t *) heap_map(old >> 6);
+	group_addr = (char **) heap_map((old >> GROUP_SHIFT) * sizeof(char *));
+	gc_threshold = 4 * heap_chunk_size;
+
+	heap_chunk = nursery;
+	cool_heap_ptr = nursery;
+	cool_heap_limit = cool_gc_flags & COOL_GC_TEST ? nursery : gc_end;
+}
+
+static void gc_report(void)
+{
+	size_t pauses = gc_stats.minor + gc_stats.major;
+	fprintf(stderr, "gc: %zu minor collections in %.3f ms, "
+		"%zu major in %.3f ms, longest pause %.3f ms\n",
+		gc_stats.minor, gc_stats.minor_ms, gc_stats.major, 
+		gc_stats.major_ms, pauses ? gc_stats.max_ms : 0.0);
+	fprintf(stderr, "gc: %zu bytes allocated in the nursery, "
+		"%zu promoted (%.1f%% survival)\n", gc_stats.nursery_bytes, 
+		gc_stats.promoted_bytes, gc_stats.nursery_bytes 
+		? 100.0 * gc_stats.promoted_bytes / gc_stats.nursery_bytes : 0.0);
+	fprintf(stderr, "gc: %zu bytes live of %zu before major collections, "
+		"%zu bytes in the old space at exit\n", gc_stats.major_after, 
+		gc_stats.major_before, (size_t) (old_top - gc_base));
+}
+
+static size_t block_size(char *p)
+{
+	uintptr_t h = *(uintptr_t *) p;
+	if (h & 1)
+		return h >> 1;
+	return (((Object_vtable *) h)->size + 7) & ~7;
+}
+
+/* Call visit on each pointer field of the block at p */
+static void scan_block(char *p, void (*visit)(char **field, bool raw))
+{
+	uintptr_t h = *(uintptr_t *) p;
+	if (h & 1)
+		return;
+	const int *map = ((Object_vtable *) h)->gc_map;
+	for (int i = 1; i <= map[0]; i++) {
+		int off = map[i];
+		visit((char **) (p + (off > 0 ? off : -off)), off < 0);
+	}
+}
+
+static void scan_roots(void (*visit)(char **field, bool raw))
+{
+	for (StackEntry *e = llvm_gc_root_chain; e; e = e->next) {
+		const FrameMap *map = e->map;
+		for (int i = 0; i < map->num_roots; i++)
+			visit((char **) &e->roots[i], 
+				i < map->num_meta && map->meta[i] == RAW_ROOT);
+	}
+}
+
+/* Bump-allocate in the old space, recording the cards whose first byte
+   the new block covers.  The old space above old_top is zero. */
+static char *old_alloc(size_t size)
+{
+	char *p = old_top;
+	old_top += size;
+	size_t first = ((p - gc_base) + (1 << CARD_SHIFT) - 1) >> CARD_SHIFT;
+	size_t last = (old_top - 1 - gc_base) >> CARD_SHIFT;
+	for (size_t c = first; c <= last; c++)
+		card_first[c] = p;
+	return p;
+}
+
+/* Cheney's copy, shared with the semispace collector: forward moves
+   the block a field points to, if it is in [copy_from, copy_end), to
+   memory from copy_alloc and leaves its new address in its header */
+static char *copy_from, *copy_end;
+static char *(*copy_alloc)(size_t size);
+
+static void forward(char **field, bool raw)
+{
+	char *v = *field;
+	if (v < copy_from || v >= copy_end)
+		return;
+	char *p = raw ? v - 8 : v;
+	uintptr_t h = *(uintptr_t *) p;
+	char *to;
+	if ((h & 3) == 2)
+		to = (char *) (h & ~(uintptr_t) 2);
+	else {
+		size_t size = block_size(p);
+		to = copy_alloc(size);
+		memcpy(to, p, size);
+		*(uintptr_t *) p = (uintptr_t) to | 2;
+	}
+	*field = raw ? to + 8 : to;
+}
+
+//
+// Minor collection: copy the live nursery objects into the old space.
+// The roots are the shadow stack and the old objects on marked cards;
+// since every survivor is promoted, no card stays marked.
+//
+static void minor_collect(void)
+{
+	char *start = old_top, *scan = old_top;
+	size_t used = cool_heap_ptr - nursery;
+
+	copy_from = nursery;
+	copy_end = cool_heap_ptr;
+	copy_alloc = old_alloc;
+	scan_roots(forward);
+	size_t ncards = (start - gc_base + (1 << CARD_SHIFT) - 1) >> CARD_SHIFT;
+	for (size_t c = 0; c < ncards; c++) {
+		if (!cards[c])
+			continue;
+		char *end = gc_base + ((c + 1) << CARD_SHIFT);
+		for (char *p = card_first[c]; p < end && p < start; p += block_size(p))
+			scan_block(p, forward);
+	}
+	for (; scan < old_top; scan += block_size(scan))
+		scan_block(scan, forward);
+
+	memset(cards, 0, ncards);
+	memset(nursery, 0, used);
+	cool_heap_ptr = nursery;
+	gc_stats.minor++;
+	gc_stats.nursery_bytes += used;
+	gc_stats.promoted_bytes += old_top - start;
+}
+
+//
+// Major collection, run with an empty nursery: mark from the shadow
+// stack, then slide the live blocks down.  Marking sets the bit of every
+// word of a live block, so the new address of a block is that of its
+// group of 32 words plus the live words before it in the group.
+//
+static bool in_old(char *p)
+{
+	return p >= gc_base && p < old_top;
+}
+
+static bool is_marked(char *p)
+{
+	size_t w = (p - gc_base) >> 3;
+	return mark_bits[w >> 5] & (1u << (w & 31));
+}
+
+static void mark(char **field, bool raw)
+{
+	char *v = *field;
+	if (!in_old(v))
+		return;
+	char *p = raw ? v - 8 : v;
+	if (is_marked(p))
+		return;
+	size_t w = (p - gc_base) >> 3, end = w + (block_size(p) >> 3);
+	for (; w < end; w++)
+		mark_bits[w >> 5] |= 1u << (w & 31);
+	if (mark_depth == mark_cap) {
+		mark_cap = mark_cap ? 2 * mark_cap : 1024;
+		mark_stack = realloc(mark_stack, mark_cap * sizeof(char *));
+		if (!mark_stack)
+			runtime_error("out of memory");
+	}
+	mark_stack[mark_depth++] = p;
+}
+
+static char *new_address(char *p)
+{
+	size_t w = (p - gc_base) >> 3;
+	uint32_t before = mark_bits[w >> 5] & ((1u << (w & 31)) - 1);
+	return group_addr[w >> 5] + 8 * __builtin_popcount(before);
+}
+
+static void relocate(char **field, bool raw)
+{
+	char *v = *field;
+	if (!in_old(v))
+		return;
+	*field = raw ? new_address(v - 8) + 8 : new_address(v);
+}
+
+static void major_collect(void)
+{
+	size_t groups = (((old_top - gc_base) >> 3) + 31) >> 5;
+	memset(mark_bits, 0, groups * sizeof(uint32_t));
+	scan_roots(mark);
+	while (mark_depth)
+		scan_block(mark_stack[--mark_depth], mark);
+
+	char *top = gc_base;
+	for (size_t g = 0; g < groups; g++) {
+		group_addr[g] = top;
+		top += 8 * __builtin_popcount(mark_bits[g]);
+	}
+
+	/* Every pointer is updated before anything moves; a block only
+	   moves down, over blocks that have been passed already */
+	scan_roots(relocate);
+	char *p;
+	for (p = gc_base; p < old_top; p += block_size(p))
+		if (is_marked(p))
+			scan_block(p, relocate);
+	for (p = gc_base; p < old_top; ) {
+		size_t size = block_size(p);
+		if (is_marked(p))
+			memmove(new_address(p), p, size);
+		p += size;
+	}
+
+	gc_stats.major++;
+	gc_stats.major_before += old_top - gc_base;
+	gc_stats.major_after += top - gc_base;
+	memset(top, 0, old_top - top);
+	old_top = gc_base;
+	for (p = gc_base; p < top; p += block_size(p))
+		old_alloc(block_size(p));
+}
+
+/* -T: every block in [lo, hi) is well formed, and every pointer from
+   the roots or those blocks into the reservation [space, space_end)
+   points to the start of a block in [lo, hi) of the right kind */
+static char *check_space, *check_space_end, *check_lo, *check_hi;
+
+static void check_field(char **field, bool raw)
+{
+	char *v = *field;
+	if (v && v >= check_space && v < check_space_end) {
+		char *p = raw ? v - 8 : v;
+		if (p < check_lo || p >= check_hi || (*(uintptr_t *) p & 1) != raw) {
+			fprintf(stderr, "gc: bad pointer %p in %p\n", v, (void *) field);
+			abort();
+		}
+	}
+}
+
+static void check_heap(char *space, char *space_end, char *lo, char *hi)
+{
+	check_space = space;
+	check_space_end = space_end;
+	check_lo = lo;
+	check_hi = hi;
+	scan_roots(check_field);
+	for (char *p = lo; p < hi; p += block_size(p)) {
+		uintptr_t h = *(uintptr_t *) p;
+		size_t size = h ? block_size(p) : 0;
+		if ((h & 3) == 2 || size < 8 || size > (size_t) (hi - p)) {
+			fprintf(stderr, "gc: bad block header at %p\n", p);
+			abort();
+		}
+		scan_block(p, check_field);
+	}
+}
+
+/* Collect the nursery and, when the old space has grown past the
+   threshold or cannot take another nursery, the old space too */
+static void gc_collect(bool full)
+{
+	double start = now_ms();
+	minor_collect();
+	double mid = now_ms();
+	gc_stats.minor_ms += mid - start;
+	if (full || (size_t) (old_top - gc_base) > gc_threshold
+	    || (size_t) (old_end - old_top) < 2 * heap_chunk_size) {
+		major_collect();
+		size_t live = old_top - gc_base;
+		gc_threshold = 2 * live > 4 * heap_chunk_size 
+			? 2 * live : 4 * heap_chunk_size;
+		gc_stats.major_ms += now_ms() - mid;
+	}
+	double pause = now_ms() - start;
+	if (pause > gc_stats.max_ms)
+		gc_stats.max_ms = pause;
+	/* The nursery is empty */
+	if (cool_gc_flags & COOL_GC_DEBUG)
+		check_heap(gc_base, gc_end, gc_base, old_top);
+	/* The next minor collection may have to promote a full nursery */
+	if ((size_t) (old_end - old_top) < heap_chunk_size)
+		runtime_error("out of memory");
+}
+
+static void *gc_alloc_slow(int size)
+{
+	if ((size_t) size > heap_chunk_size / 4) {
+		/* Large blocks (string bodies) go to the old space directly */
+		if (cool_gc_flags & COOL_GC_TEST
+		    || (size_t) (old_end - old_top) < size + heap_chunk_size)
+			gc_collect(true);
+		if ((size_t) (old_end - old_top) < size + heap_chunk_size)
+			runtime_error("out of memory");
+		heap_large++;
+		heap_large_bytes += size;
+		return old_alloc(size);
+	}
+	if (size > cool_heap_limit - cool_heap_ptr || cool_gc_flags & COOL_GC_TEST)
+		gc_collect(false);
+	char *p = cool_heap_ptr;
+	cool_heap_ptr = p + size;
+	cool_heap_limit = cool_gc_flags & COOL_GC_TEST ? cool_heap_ptr : gc_end;
+	return p;
+}
+
+/* Only called by programs compiled with -g, but harmless without */
+void cool_write_barrier(void *obj)
+{
+	if (cards)
+		cards[((char *) obj - gc_base) >> CARD_SHIFT] = 1;
+}
+
+
+/*
+// Semispace collector (cgen -semispace), see coolrt.h
+//
+// Every object lives in one space, and a collection copies the live ones
+// into a fresh space, which becomes the allocation space.  A space is a
+// reservation of COOL_HEAP_MAX bytes of which the program may fill
+// semi_size: COOL_HEAP_SIZE at first, and after a collection three times
+// the live data when that is more, so that the program can allocate at
+// least twice its live data between collections.  The size never
+// shrinks.  The space collected is unmapped, or with -T left inaccessible
+// until the next collection, so that a stale pointer faults.
+*/
+static char *semi_base, *semi_top;
+static char *semi_mark;	/* allocation since semi_mark is not yet counted */
+static char *semi_stale;	/* the space last collected under -T */
+static size_t semi_size, semi_max;
+
+static struct {
+	size_t collections;
+	double ms, max_ms;
+	size_t allocated, copied;
+} semi_stats;
+
+static void semi_init(void)
+{
+	const char *max = getenv("COOL_HEAP_MAX");
+	semi_max = max ? parse_size(max) : (size_t) 1 << 30;
+	semi_max = (semi_max + 4095) & ~(size_t) 4095;
+	semi_size = heap_chunk_size < semi_max ? heap_chunk_size : semi_max;
+	semi_base = semi_mark = heap_map(semi_max);
+	heap_chunk = semi_base;
+	cool_heap_ptr = semi_base;
+	cool_heap_limit = semi_base + 
+		(cool_gc_flags & COOL_GC_TEST ? 0 : semi_size);
+}
+
+static void semi_report(void)
+{
+	fprintf(stderr, "gc: %zu semispace collections in %.3f ms, "
+		"longest pause %.3f ms\n", semi_stats.collections, semi_stats.ms,
+		semi_stats.max_ms);
+	fprintf(stderr, "gc: %zu bytes copied (%.1f%% of the allocation), "
+		"%zu bytes live at the last collection of a %zu byte space\n",
+		semi_stats.copied, semi_stats.allocated 
+		? 100.0 * semi_stats.copied / semi_stats.allocated : 0.0,
+		(size_t) (semi_mark - semi_base), semi_size);
+}
+
+static char *semi_copy_alloc(size_t size)
+{
+	char *p = semi_top;
+	semi_top += size;
+	return p;
+}
+
+/* Collect, and grow the space so that need more bytes fit */
+static void semi_collect(size_t need)
+{
+	double start = now_ms();
+	char *to = heap_map(semi_max);
+	copy_from = semi_base;
+	copy_end = cool_heap_ptr;
+	copy_alloc = semi_copy_alloc;
+	semi_top = to;
+	scan_roots(forward);
+	for (char *scan = to; scan < semi_top; scan += block_size(scan))
+		scan_block(scan, forward);
+
+	size_t live = semi_top - to;
+	semi_stats.collections++;
+	semi_stats.allocated += cool_heap_ptr - semi_mark;
+	semi_stats.copied += live;
+	if (semi_stale)
+		munmap(semi_stale, semi_max);
+	semi_stale = NULL;
+	if (cool_gc_flags & COOL_GC_DEBUG) {
+		madvise(semi_base, semi_max, MADV_DONTNEED);
+		mprotect(semi_base, semi_max, PROT_NONE);
+		semi_stale = semi_base;
+	} else
+		munmap(semi_base, semi_max);
+	semi_base = heap_chunk = to;
+	semi_mark = cool_heap_ptr = semi_top;
+
+	if (3 * live > semi_size)
+		semi_size = 3 * live;
+	if (live + need > semi_size)
+		semi_size = live + need;
+	semi_size = (semi_size + 4095) & ~(size_t) 4095;
+	if (semi_size > semi_max) {
+		if (live + need > semi_max)
+			runtime_error("out of memory");
+		semi_size = semi_max;
+	}
+
+	double pause = now_ms() - start;
+	semi_stats.ms += pause;
+	if (pause > semi_stats.max_ms)
+		semi_stats.max_ms = pause;
+	if (cool_gc_flags & COOL_GC_DEBUG)
+		check_heap(semi_base, semi_base + semi_max, semi_base, semi_top);
+}
+
+static void *semi_alloc_slow(int size)
+{
+	if (size > cool_heap_limit - cool_heap_ptr || cool_gc_flags & COOL_GC_TEST)
+		semi_collect(size);
+	char *p = cool_heap_ptr;
+	cool_heap_ptr = p + size;
+	cool_heap_limit = cool_gc_flags & COOL_GC_TEST 
+		? cool_heap_ptr : semi_base + semi_size;
+	return p;
+}
+
+static size_t heap_allocated(void)
+{
+	if (cool_gc_flags & COOL_GC_SEMISPACE)
+		return semi_stats.allocated + (cool_heap_ptr - semi_mark);
+	if (cool_gc_flags & COOL_GC_ENABLED)
+		return gc_stats.nursery_bytes + (cool_heap_ptr - nursery) 
+			+ heap_large_bytes;
+	return heap_retired_bytes + (cool_heap_ptr - heap_chunk) 
+		+ heap_large_bytes;
+}
+
+static double gc_ms(void)
+{
+	if (cool_gc_flags & COOL_GC_SEMISPACE)
+		return semi_stats.ms;
+	return gc_stats.minor_ms + gc_stats.major_ms;
+}
+
+
+/*
+// Buffered standard output, see coolrt.h
+*/
+static char *out_buf;
+static size_t out_len, out_cap;
+static bool out_tty;
+
+static void out_flush(void)
+{
+	char *p = out_buf;
+	while (out_len > 0) {
+		ssize_t n = write(1, p, out_len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			break;
+		p += n;
+		out_len -= n;
+	}
+	out_len = 0;
+}
+
+/* abort() from the runtime or the generated error stubs */
+static void out_abort(int sig)
+{
+	out_flush();
+	signal(sig, SIG_DFL);
+}
+
+static void out_init(void)
+{
+	const char *size = getenv("COOL_OUTPUT_BUFFER");
+	out_cap = size ? parse_size(size) : 64 << 10;
+	if (out_cap < 16)
+		out_cap = 16;
+	out_buf = malloc(out_cap);
+	if (!out_buf)
+		runtime_error("out of memory");
+	out_tty = isatty(1);
+	atexit(out_flush);
+	signal(SIGABRT, out_abort);
+}
+
+/* A terminal sees each line as it is completed, like stdio */
+static void out_done(void)
+{
+	if (out_tty && memchr(out_buf, '\n', out_len))
+		out_flush();
+}
+
+static void out_bytes(const char *s, size_t n)
+{
+	if (!out_buf)
+		out_init();
+	while (n > out_cap - out_len) {
+		size_t room = out_cap - out_len;
+		memcpy(out_buf + out_len, s, room);
+		out_len = out_cap;
+		out_flush();
+		s += room;
+		n -= room;
+	}
+	memcpy(out_buf + out_len, s, n);
+	out_len += n;
+	out_done();
+}
+
+/* Copies up to the NUL in the same pass that finds it */
+static void out_cstr(const char *s)
+{
+	if (!out_buf)
+		out_init();
+	char *end;
+	while (!(end = memccpy(out_buf + out_len, s, '\0', out_cap - out_len))) {
+		s += out_cap - out_len;
+		out_len = out_cap;
+		out_flush();
+	}
+	out_len = end - 1 - out_buf;
+	out_done();
+}
+
+static const char digit_pairs[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/* Two digits per division, from the right */
+static void out_int(int x)
+{
+	char buf[12], *p = buf + sizeof buf;
+	unsigned u = x < 0 ? 0u - (unsigned) x : (unsigned) x;
+	while (u >= 100) {
+		unsigned q = u / 100;
+		p -= 2;
+		memcpy(p, digit_pairs + 2 * (u - q * 100), 2);
+		u = q;
+	}
+	if (u >= 10) {
+		p -= 2;
+		memcpy(p, digit_pairs + 2 * u, 2);
+	} else
+		*--p = '0' + u;
+	if (x < 0)
+		*--p = '-';
+	out_bytes(p, buf + sizeof buf - p);
+}
 
 
 /*
@@ -30,8 +860,10 @@ const Object_vtable Object_vtable_prototype = {
 */
 Object* Object_abort(Object *self)
 {
-	printf("Abort called from class %s\n",
-	       !self? "Unknown" : self->vtblptr->name);
+	out_cstr("Abort called from class ");
+	out_cstr(!self? "Unknown" : self->vtblptr->name);
+	out_cstr("\n");
+	out_flush();
 	exit(1);
 	return self;
 }
@@ -42,18 +874,50 @@ const String* Object_type_name(Object *self)
 		fprintf(stderr, "At __FILE__(line __LINE__): self is NULL\n");
 		abort();
 	}
+	/* The name is static, and self may move in String_new */
+	char *name = (char *) self->vtblptr->name;
 	String *s = String_new();
-	s->val = self->vtblptr->name;
+	s->val = name;
+	s->len = strlen(name);
 	return s;
 }
 
 
 /* ADD CODE HERE FOR MORE METHODS OF CLASS OBJECT */
+Object* Object_new(void)
+{
+	Object *self = cool_alloc(sizeof(Object));
+	Object_init(self);
+	return self;
+}
+
+void Object_init(Object *self)
+{
+	self->vtblptr = (Object_vtable *) &Object_vtable_prototype;
+}
+
+/* A shallow copy of the same size as the dynamic class */
+Object* Object_copy(Object *self)
+{
+	if (self == 0) {
+		fprintf(stderr, "At __FILE__(line __LINE__): self is NULL\n");
+		abort();
+	}
+	struct c_frame f = { .roots = { self } };
+	push_roots(&f, &one_root);
+	Object *copy = cool_alloc(self->vtblptr->size);
+	self = f.roots[0];
+	memcpy(copy, self, self->vtblptr->size);
+	pop_roots(&f);
+	return copy;
+}
 
 
 /*
 // Methods in class IO (only some are provided to you)
 */
+static String *string_flat(String *s);
+
 
 IO* IO_out_string(IO *self, String* x)
 {
@@ -61,45 +925,115 @@ IO* IO_out_string(IO *self, String* x)
 		fprintf(stderr, "At __FILE__(line __LINE__): NULL object\n");
 		abort();
 	}
-	printf("%s",x->val);
+	if (!x->val) {
+		struct c_frame f = { .roots = { self } };
+		push_roots(&f, &one_root);
+		x = string_flat(x);
+		self = f.roots[0];
+		pop_roots(&f);
+	}
+	out_bytes(x->val + x->offset, x->len);
 	return self;
 }
 
-IO* IO_out_int(IO *self, Int* x)
+IO* IO_out_int(IO *self, int x)
 {
-	if (self == 0 || x == 0) {
+	if (self == 0) {
 		fprintf(stderr, "At __FILE__(line __LINE__): NULL object\n");
 		abort();
 	}
-	printf("%d",x->val);
+	out_int(x);
 	return self;
 }
 
 
 /*
- * Get one line from stream using get_line(), then discard newline character.
- * Allocate string *in_string_p and store result there.
- * Return number of chars read. 
- */
-static int get_one_line(char** in_string_p, FILE* stream)
+// Standard input, see coolrt.h
+//
+// A regular file is mapped whole, read-only, and the String of
+// in_string points straight into the mapping.  Anything else is read in
+// blocks of at least COOL_INPUT_BUFFER bytes, which for the same reason
+// are only freed if no String was taken from them.
+*/
+static char *in_buf, *in_ptr, *in_end;	/* block, unread input, end */
+static size_t in_block;
+static bool in_ready, in_eof, in_sliced;
+
+static void in_init(void)
 {
-	/* Get one line worth of input */
-	size_t len = 0;
-	ssize_t num_chars_read;
-	num_chars_read = getline(in_string_p, &len, stdin);
-	if (*in_string_p == 0) {
-		fprintf(stderr, "At __FILE__(line __LINE__):\n   ");
-		fprintf(stderr, "    allocation failed in IO::in_string()\n");
-		exit(1);
-	}
-	
-	/* Discard the newline char, if any.  It may not exist if EOF reached. */
-	if (num_chars_read > 0 && (*in_string_p)[num_chars_read-1] == '\n') {
-		(*in_string_p)[num_chars_read-1] = '\0';
-		--len;
+	const char *size = getenv("COOL_INPUT_BUFFER");
+	in_block = size ? parse_size(size) : 64 << 10;
+	if (in_block < 16)
+		in_block = 16;
+	in_ready = true;
+
+	struct stat st;
+	off_t pos = lseek(0, 0, SEEK_CUR);
+	if (fstat(0, &st) < 0 || !S_ISREG(st.st_mode) || pos < 0 || 
+	    pos >= st.st_size)
+		return;
+	char *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, 0, 0);
+	if (p == MAP_FAILED)
+		return;
+	in_ptr = p + pos;
+	in_end = p + st.st_size;
+	in_eof = true;
+}
+
+/* Read another block behind the unread part of the current one */
+static bool in_fill(void)
+{
+	if (in_eof)
+		return false;
+	size_t have = in_end - in_ptr;
+	size_t cap = have * 2 > in_block ? have * 2 : in_block;
+	char *buf = malloc(cap);
+	if (!buf)
+		runtime_error("out of memory");
+	if (have)
+		memcpy(buf, in_ptr, have);
+	if (!in_sliced)
+		free(in_buf);
+	in_buf = in_ptr = buf;
+	in_end = buf + have;
+	in_sliced = false;
+
+	/* A prompt written before the read must appear while it waits */
+	out_flush();
+	ssize_t n;
+	do
+		n = read(0, in_end, cap - have);
+	while (n < 0 && errno == EINTR);
+	if (n <= 0) {
+		in_eof = true;
+		return false;
 	}
+	in_end += n;
+	return true;
+}
+
+/*
+ * The next line of stdin without its newline, where it lies, and its
+ * length; the empty string at end of file.
+ */
+static char *get_one_line(size_t *len)
+{
+	if (!in_ready)
+		in_init();
 
-	return len;
+	size_t scanned = 0;
+	char *nl;
+	while (!(nl = in_ptr + scanned < in_end 
+		? memchr(in_ptr + scanned, '\n', in_end - in_ptr - scanned) : NULL)) {
+		scanned = in_end - in_ptr;
+		if (!in_fill())
+			break;
+	}
+	char *line = in_ptr;
+	/* The last line may have no newline */
+	in_ptr = nl ? nl + 1 : in_end;
+	*len = (nl ? nl : in_end) - line;
+	return *len ? line : (char *) default_string;
 }
 
 /*
@@ -113,14 +1047,13 @@ String* IO_in_string(IO *self)
 		abort();
 	}
 
-	/* Get one line worth of input with the newline, if any, discarded */
-	char* in_string = 0;
-	ssize_t len = get_one_line(&in_string, stdin);
-	assert(in_string);
-	
-	/* We can take advantage of knowing the internal layout of String objects */
+	/* The body stays in the input buffer, outside the heap */
+	size_t len;
+	char *line = get_one_line(&len);
+	in_sliced = true;
 	String *str = String_new();
-	str->val = in_string;
+	str->val = line;
+	str->len = len;
 	return str;
 }
 
@@ -130,7 +1063,7 @@ String* IO_in_string(IO *self)
  * Any characters following the integer, up to and including the next newline,
  * are discarded by in_int.
  */
-Int* IO_in_int(IO *self)
+int IO_in_int(IO *self)
 {
 	if (self == 0) {
 		fprintf(stderr, "At __FILE__(line __LINE__): self is NULL\n");
@@ -138,18 +1071,32 @@ Int* IO_in_int(IO *self)
 	}
 
 	/* Get one line worth of input with the newline, if any, discarded */
-	char* in_string = 0;
-	ssize_t len = get_one_line(&in_string, stdin);
-	assert(in_string);
+	size_t len;
+	const char *p = get_one_line(&len), *end = p + len;
 
-	/* Now extract initial int and ignore the rest of the line */
-	Int *x = Int_new();
-	int num_ints = 0;
-	if (len)
-		num_ints = sscanf(in_string, " %d", &(x->val)); /* Discards initial spaces*/
+	/* Parse as scanf(" %d") did, wrapping on overflow.  The line is
+	   not NUL-terminated, but scanf stopped at a NUL. */
+	const char *nul = memchr(p, '\0', len);
+	if (nul)
+		end = nul;
+	while (p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r')))
+		p++;
+	/* scanf returned EOF rather than 0 on a line of whitespace */
+	if (len && p == end)
+		return 0;
+	bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+'))
+		p++;
+	unsigned x = 0;
+	int num_ints = p < end && *p >= '0' && *p <= '9';
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+		x = x * 10 + (*p - '0');
+	if (negative)
+		x = 0u - x;
 
 	/* If no text found, abort. */
 	if (num_ints == 0) {
+		out_flush();
 		fprintf(stderr, "At __FILE__(line __LINE__):\n   ");
 		fprintf(stderr, "    Invalid integer on input in IO::in_int()");
 		Object_abort((Object*) self);
@@ -159,8 +1106,297 @@ Int* IO_in_int(IO *self)
 
 
 /* ADD CODE HERE FOR MORE METHODS OF CLASS IO */
+IO* IO_new(void)
+{
+	IO *self = cool_alloc(sizeof(IO));
+	IO_init(self);
+	return self;
+}
+
+void IO_init(IO *self)
+{
+	self->vtblptr = (IO_vtable *) &IO_vtable_prototype;
+}
 
 
 /* ADD CODE HERE FOR METHODS OF OTHER BUILTIN CLASSES */
+Int* Int_new(void)
+{
+	Int *self = cool_alloc(sizeof(Int));
+	Int_init(self, 0);
+	return self;
+}
+
+void Int_init(Int *self, int x)
+{
+	self->vtblptr = (Int_vtable *) &Int_vtable_prototype;
+	self->val = x;
+}
+
+Bool* Bool_new(void)
+{
+	Bool *self = cool_alloc(sizeof(Bool));
+	Bool_init(self, false);
+	return self;
+}
+
+void Bool_init(Bool *self, bool x)
+{
+	self->vtblptr = (Bool_vtable *) &Bool_vtable_prototype;
+	self->val = x;
+}
+
+String* String_new(void)
+{
+	String *self = cool_alloc(sizeof(String));
+	String_init(self);
+	return self;
+}
+
+void String_init(String *self)
+{
+	self->vtblptr = (String_vtable *) &String_vtable_prototype;
+	self->val = (char *) default_string;
+	self->len = 0;
+	self->hash = 0;
+	self->offset = 0;
+	self->left = self->right = NULL;
+}
+
+
+/*
+// Ropes, see coolrt.h
+//
+// concat copies results shorter than ROPE_MIN and makes rope nodes for
+// longer ones, so a loop that builds a long string does not copy it at
+// every step.  A rope is flattened in place when its chars are needed,
+// by substr, out_string or String_hash, and at once when it would be
+// deeper than ROPE_MAX_DEPTH, which bounds the recursion of flattening
+// and of rope_join.
+*/
+#define ROPE_MIN 64
+#define ROPE_MAX_DEPTH 48
+
+static int rope_depth(const String *s)
+{
+	return s->val ? 0 : s->depth;
+}
+
+/* Copy the chars of s to to, returning the end */
+static char *rope_copy(const String *s, char *to)
+{
+	for (; !s->val; s = s->right)
+		to = rope_copy(s->left, to);
+	memcpy(to, s->val + s->offset, s->len);
+	return to + s->len;
+}
+
+/* Returns s flattened, which may have moved */
+static String *string_flat(String *s)
+{
+	if (s->val)
+		return s;
+	struct c_frame f = { .roots = { s } };
+	push_roots(&f, &one_root);
+	char *val = cool_alloc_raw(s->len);
+	s = f.roots[0];
+	pop_roots(&f);
+	rope_copy(s, val);
+	s->val = val;
+	s->offset = 0;
+	s->left = s->right = NULL;
+	s->hash = 0;
+	cool_write_barrier(s);
+	return s;
+}
+
+int String_length(String *self)
+{
+	if (self == 0) {
+		fprintf(stderr, "At __FILE__(line __LINE__): self is NULL\n");
+		abort();
+	}
+	return self->len;
+}
+
+/* FNV-1a of the chars, cached in the String; never 0 */
+unsigned String_hash(String *self)
+{
+	if (self == 0) {
+		fprintf(stderr, "At __FILE__(line __LINE__): self is NULL\n");
+		abort();
+	}
+	self = string_flat(self);
+	if (!self->hash) {
+		const unsigned char *p = (unsigned char *) self->val + self->offset;
+		unsigned h = 2166136261u;
+		for (int i = 0; i < self->len; i++)
+			h = (h ^ p[i]) * 16777619u;
+		self->hash = h ? h : 1;
+	}
+	return self->hash;
+}
 
+/*
+ * The = of generated code, which has already decided the same String
+ * and different lengths inline.  Hashes are compared only when both
+ * are cached, since computing them reads all the chars anyway.
+ */
+bool String_equal(String *a, String *b)
+{
+	if (a == 0 || b == 0) {
+		fprintf(stderr, "At __FILE__(line __LINE__): NULL object\n");
+		abort();
+	}
+	if (a == b)
+		return true;
+	if (a->len != b->len)
+		return false;
+	if (!a->val || !b->val) {
+		struct c_frame f = { .roots = { a, b } };
+		push_roots(&f, &two_roots);
+		f.roots[0] = string_flat(f.roots[0]);
+		f.roots[1] = string_flat(f.roots[1]);
+		a = f.roots[0];
+		b = f.roots[1];
+		pop_roots(&f);
+	}
+	if (a->hash && b->hash && a->hash != b->hash)
+		return false;
+	return memcmp(a->val + a->offset, b->val + b->offset, a->len) == 0;
+}
+
+/* A new node over l and r */
+static String *rope_node(String *l, String *r)
+{
+	struct c_frame f = { .roots = { l, r } };
+	push_roots(&f, &two_roots);
+	String *res = String_new();
+	l = f.roots[0];
+	r = f.roots[1];
+	pop_roots(&f);
+	int d1 = rope_depth(l), d2 = rope_depth(r);
+	res->val = NULL;
+	res->len = l->len + r->len;
+	res->depth = (d1 > d2 ? d1 : d2) + 1;
+	res->left = l;
+	res->right = r;
+	if (res->depth > ROPE_MAX_DEPTH)
+		res = string_flat(res);
+	return res;
+}
+
+/*
+ * The chars of l then r.  A short result is copied flat; otherwise r
+ * joins the right side of l when that is shallower than its left, and
+ * l the left side of r likewise, so that appending or prepending in a
+ * loop builds a tree about log2 of its leaves deep, whose short leaves
+ * keep being merged.
+ */
+static String *rope_join(String *l, String *r)
+{
+	if (r->len == 0)
+		return l;
+	if (l->len == 0)
+		return r;
+	if (l->len > INT_MAX - r->len)
+		runtime_error("out of memory");
+	int len = l->len + r->len;
+	struct c_frame f = { .roots = { l, r } };
+	push_roots(&f, &two_roots);
+	String *res;
+	if (len < ROPE_MIN) {
+		/* Both sides are shorter, so flat */
+		char *val = cool_alloc_raw(len);
+		l = f.roots[0];
+		r = f.roots[1];
+		memcpy(val, l->val + l->offset, l->len);
+		memcpy(val + l->len, r->val + r->offset, r->len);
+		f.roots[0] = val;
+		f.map = (const FrameMap *) &one_raw_root;
+		res = String_new();
+		res->val = f.roots[0];
+		res->len = len;
+	} else if (!l->val && rope_depth(l->left) > rope_depth(l->right)) {
+		f.roots[0] = l->left;
+		f.roots[1] = rope_join(l->right, r);
+		res = rope_node(f.roots[0], f.roots[1]);
+	} else if (!r->val && rope_depth(r->right) > rope_depth(r->left)) {
+		f.roots[1] = r->right;
+		f.roots[0] = rope_join(l, r->left);
+		res = rope_node(f.roots[0], f.roots[1]);
+	} else
+		res = rope_node(l, r);
+	pop_roots(&f);
+	return res;
+}
 
+String* String_concat(String *self, String *s)
+{
+	if (self == 0 || s == 0) {
+		fprintf(stderr, "At __FILE__(line __LINE__): NULL object\n");
+		abort();
+	}
+	/* Strings are immutable, so this may return self or s */
+	return rope_join(self, s);
+}
+
+/* The Strings of one char, outside the heap, for scanning loops */
+static String char_strings[256];
+static char char_bodies[256];
+
+static String *char_string(unsigned char c)
+{
+	String *s = &char_strings[c];
+	if (!s->val) {
+		s->vtblptr = (String_vtable *) &String_vtable_prototype;
+		char_bodies[c] = c;
+		s->val = &char_bodies[c];
+		s->len = 1;
+	}
+	return s;
+}
+
+/*
+ * A slice shares the body of self.  It keeps the whole body alive, so
+ * a slice shorter than an eighth of self is copied instead: a big
+ * string is not retained by a few chars of it, and those few chars are
+ * cheap to copy.  A single char needs neither.
+ */
+String* String_substr(String *self, int i, int l)
+{
+	if (self == 0) {
+		fprintf(stderr, "At __FILE__(line __LINE__): self is NULL\n");
+		abort();
+	}
+	int len = self->len;
+	if (i < 0 || l < 0 || i > len || l > len - i)
+		runtime_error("Index to substr is out of range");
+	if (l == len)
+		return self;
+	if (l == 0)
+		return String_new();
+	self = string_flat(self);
+	if (l == 1)
+		return char_string(self->val[self->offset + i]);
+	struct c_frame f = { .roots = { self } };
+	push_roots(&f, &one_root);
+	String *res;
+	if (l < len / 8) {
+		char *val = cool_alloc_raw(l);
+		self = f.roots[0];
+		memcpy(val, self->val + self->offset + i, l);
+		f.roots[0] = val;
+		f.map = (const FrameMap *) &one_raw_root;
+		res = String_new();
+		res->val = f.roots[0];
+	} else {
+		res = String_new();
+		self = f.roots[0];
+		res->val = self->val;
+		res->offset = self->offset + i;
+	}
+	res->len = l;
+	pop_roots(&f);
+	return res;
+}
@@ -21,66 +21,223 @@ typedef struct Bool_vtable Bool_vtable;
 /* class type definitions */
 struct Object {
 	/* ADD CODE HERE */
+	Object_vtable *vtblptr;
 };
 
+/* Int and Bool are only boxed when they flow into a non-Int/Bool type;
+   the generated code relies on val directly following the vtable */
 struct Int {
 	/* ADD CODE HERE */
+	Int_vtable *vtblptr;
+	int val;
 };
 
 struct Bool {
 	/* ADD CODE HERE */
+	Bool_vtable *vtblptr;
+	bool val;
 };
 
+/* A String is flat, with len chars at val + offset, or a rope made by
+   concat: val is NULL until the chars are first needed, and they are
+   those of left followed by those of right.  val is the start of a
+   string body, which substr shares between Strings, so the chars are
+   not NUL-terminated and may include NULs.  Generated code reads len
+   directly. */
 struct String {
 	/* ADD CODE HERE */
+	String_vtable *vtblptr;
+	char *val;
+	int len;
+	union {
+		unsigned hash;	/* flat: String_hash, or 0 until computed */
+		int depth;	/* rope: height of the tree */
+	};
+	int offset;
+	String *left, *right;
 };
 
 struct IO {
 	/* ADD CODE HERE */
+	IO_vtable *vtblptr;
 };
 
 
-/* vtable type definitions */
+/* vtable type definitions
+   Every vtable starts with the class tag, the object size, the class name,
+   the pointer map for the collector and the allocator, followed by the
+   methods in inheritance order.  The tags are the ones cgen gives the
+   basic classes. */
 struct Object_vtable {
 	/* ADD CODE HERE */
+	int tag;
+	int size;
+	const char *name;
+	const int *gc_map;
+	Object* (*Object_new)(void);
+	Object* (*Object_abort)(Object*);
+	const String* (*Object_type_name)(Object*);
+	Object* (*Object_copy)(Object*);
 };
 
 struct IO_vtable {
 	/* ADD CODE HERE */
+	int tag;
+	int size;
+	const char *name;
+	const int *gc_map;
+	IO* (*IO_new)(void);
+	Object* (*Object_abort)(Object*);
+	const String* (*Object_type_name)(Object*);
+	IO* (*Object_copy)(IO*);
+	IO* (*IO_out_string)(IO*, String*);
+	IO* (*IO_out_int)(IO*, int);
+	String* (*IO_in_string)(IO*);
+	int (*IO_in_int)(IO*);
 };
 
 struct Int_vtable {
 	/* ADD CODE HERE */
+	int tag;
+	int size;
+	const char *name;
+	const int *gc_map;
+	Int* (*Int_new)(void);
+	Object* (*Object_abort)(Object*);
+	const String* (*Object_type_name)(Object*);
+	Int* (*Object_copy)(Int*);
 };
 
 struct Bool_vtable {
 	/* ADD CODE HERE */
+	int tag;
+	int size;
+	const char *name;
+	const int *gc_map;
+	Bool* (*Bool_new)(void);
+	Object* (*Object_abort)(Object*);
+	const String* (*Object_type_name)(Object*);
+	Bool* (*Object_copy)(Bool*);
 };
    
 struct String_vtable {
 	/* ADD CODE HERE */
+	int tag;
+	int size;
+	const char *name;
+	const int *gc_map;
+	String* (*String_new)(void);
+	Object* (*Object_abort)(Object*);
+	const String* (*Object_type_name)(Object*);
+	String* (*Object_copy)(String*);
+	int (*String_length)(String*);
+	String* (*String_concat)(String*, String*);
+	String* (*String_substr)(String*, int, int);
 };
 
 /* methods in class Object */
+Object* Object_new(void);
+void Object_init(Object *self);
 Object* Object_abort(Object *self);
 const String* Object_type_name(Object *self);
-	/* ADD CODE HERE */
-
-/* methods in class IO */
+Object* Object_copy(Object *self);
+
+/* methods in class IO
+   Int arguments and results are unboxed, as in generated code.
+   Output goes through a buffer of COOL_OUTPUT_BUFFER bytes (default
+   64k), written to stdout at exit, on abort, before the runtime waits
+   for input, and at the end of each line when stdout is a terminal.
+   Input comes from a private mapping of stdin when it is a regular
+   file, or else from blocks of COOL_INPUT_BUFFER bytes (default 64k);
+   in_string returns Strings whose bodies stay in that input. */
 IO* IO_new(void);
 void IO_init(IO *self);
 IO* IO_out_string(IO *self, String *x);
-IO* IO_out_int(IO *self, Int *x);
+IO* IO_out_int(IO *self, int x);
 String* IO_in_string(IO *self);
-Int* IO_in_int(IO *self);
+int IO_in_int(IO *self);
 
 /* methods in class Int */
-	/* ADD CODE HERE */
-
+Int* Int_new(void);
+void Int_init(Int *self, int x);
 
 /* methods in class Bool */
-	/* ADD CODE HERE */
-
+Bool* Bool_new(void);
+void Bool_init(Bool *self, bool x);
 
 /* methods in class String */
-	/* ADD CODE HERE */
+String* String_new(void);
+void String_init(String *self);
+int String_length(String *self);
+String* String_concat(String *self, String *s);
+String* String_substr(String *self, int i, int l);
+unsigned String_hash(String *self);
+bool String_equal(String *a, String *b);
+
+/* Runtime heap
+   Objects and string bodies are bump-allocated from large chunks taken
+   from mmap, and never freed.  The fast path is inline here and cgen
+   emits the same code as IR; cool_alloc_slow maps the next chunk, or a
+   mapping of its own for anything bigger than a quarter chunk (long
+   strings).  Allocations are 8-byte aligned and zero-filled.
+
+   COOL_HEAP_SIZE       chunk size in bytes, with an optional k, m or g
+                        suffix (default 8m)
+   COOL_HEAP_HUGEPAGES  ask for transparent huge pages on the chunks
+   COOL_HEAP_STATS      print heap usage on stderr at exit
+
+   String bodies come from cool_alloc_raw, which puts a header word in
+   front of them (see below). */
+extern __thread char *cool_heap_ptr;
+extern __thread char *cool_heap_limit;
+void *cool_alloc_slow(int size);
+
+static inline void *cool_alloc(int size)
+{
+	char *p = cool_heap_ptr;
+	size = (size + 7) & ~7;
+	if (size > cool_heap_limit - p)
+		return cool_alloc_slow(size);
+	cool_heap_ptr = p + size;
+	return p;
+}
+
+void *cool_alloc_raw(int size);
+
+/* Garbage collection
+   Programs compiled with cgen -g define cool_gc_flags, and the heap is
+   then collected.  Objects are bump-allocated in a nursery; a minor
+   collection copies the survivors into the old space, and the old space
+   is compacted in place once it has grown enough.  Roots are exact: the
+   generated code keeps every object pointer that lives across an
+   allocation in a slot of LLVM's shadow stack, and the runtime pushes
+   frames of its own.  An old object that may point into the nursery is
+   remembered by the card cool_write_barrier marks on each attribute
+   store.  With -t every allocation collects, with -T the heap is checked
+   after each collection.
+
+   Every heap block starts with a header word: the vtable pointer of an
+   object, or (size << 1) | 1 for a string body, whose chars follow.  The
+   pointer fields of an object are listed by gc_map in its vtable: their
+   number, then their byte offsets, negated for a pointer to a string
+   body.
+
+   With the collector COOL_HEAP_SIZE is the nursery size, COOL_HEAP_MAX
+   (default 1g) the address space reserved for the whole heap, and
+   COOL_HEAP_STATS also reports pause times and survival.
+
+   cgen -semispace selects a stop-and-copy collector instead, for
+   programs that allocate much and keep little: all objects are copied
+   to a fresh space at each collection.  COOL_HEAP_SIZE is then the
+   initial size of the space, which grows to three times the live data,
+   up to COOL_HEAP_MAX.  Every memory manager reports its allocation
+   throughput and the share of the run spent collecting under
+   COOL_HEAP_STATS. */
+enum {
+	COOL_GC_ENABLED = 1,
+	COOL_GC_TEST = 2,
+	COOL_GC_DEBUG = 4,
+	COOL_GC_SEMISPACE = 8
+};
+extern int cool_gc_flags;
+void cool_write_barrier(void *obj);
@@ -0,0 +1,171 @@
+#include "ir_sink.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static void out_of_memory(size_t n)
+{
+	fprintf(stderr, "out of memory for %lu bytes of IR output\n", 
+		(unsigned long) n);
+	exit(1);
+}
+
+IRSink::IRSink(size_t reserved)
+  : target(TO_MEMORY), file(NULL), down(NULL), fd(-1), cap(reserved ? reserved : 1)
+{
+	buf = (char *) malloc(cap);
+	if (!buf)
+		out_of_memory(cap);
+	setp(buf, buf + cap);
+}
+
+IRSink::~IRSink()
+{
+	close();
+	free(buf);
+}
+
+void IRSink::open_file(FILE *f)
+{
+	target = TO_FILE;
+	file = f;
+}
+
+void IRSink::open_stream(ostream &o)
+{
+	target = TO_STREAM;
+	down = &o;
+}
+
+bool IRSink::open_copy(const char *path)
+{
+	fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	target = TO_COPY;
+	return true;
+}
+
+/* Make room for n more bytes: write the buffer out if there is somewhere
+ * to write it, grow it otherwise
+ */
+void IRSink::reserve(size_t n)
+{
+	if (target == TO_FILE || target == TO_STREAM)
+		flush();
+	size_t used = size();
+	if (cap - used >= n)
+		return;
+	while (cap - used < n)
+		cap *= 2;
+	char *grown = (char *) realloc(buf, cap);
+	if (!grown)
+		out_of_memory(cap);
+	buf = grown;
+	setp(buf, buf + cap);
+	advance(used);
+}
+
+void IRSink::append_int(long v)
+{
+	char tmp[24];
+	char *p = tmp + sizeof(tmp);
+	unsigned long u = v < 0 ? 0ul - (unsigned long) v : (unsigned long) v;
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	if (v < 0)
+		*--p = '-';
+	append(p, tmp + sizeof(tmp) - p);
+}
+
+void IRSink::flush()
+{
+	size_t n = size();
+	if (n == 0)
+		return;
+	if (target == TO_FILE)
+		fwrite(buf, 1, n, file);
+	else if (target == TO_STREAM)
+		down->write(buf, n);
+	else
+		return;
+	setp(buf, buf + cap);
+}
+
+/* Copy the n buffered bytes into the file through a shared mapping */
+bool IRSink::copy_mapped(size_t n)
+{
+	if (ftruncate(fd, n) != 0) {
+		fprintf(stderr, "cannot extend output file: %s; writing it instead\n",
+			strerror(errno));
+		return false;
+	}
+	void *out = mmap(NULL, n, PROT_WRITE, MAP_SHARED, fd, 0);
+	if (out == MAP_FAILED) {
+		fprintf(stderr, "cannot map output file: %s; writing it instead\n",
+			strerror(errno));
+		return false;
+	}
+	memcpy(out, buf, n);
+	return munmap(out, n) == 0;
+}
+
+/* Write the n buffered bytes to the file with write(), over anything a
+ * failed mapping left.  A pipe cannot seek, and has nothing to rewind. */
+bool IRSink::copy_written(size_t n)
+{
+	lseek(fd, 0, SEEK_SET);
+	for (size_t done = 0; done < n; ) {
+		ssize_t w = ::write(fd, buf + done, n - done);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return false;
+		done += w;
+	}
+	return true;
+}
+
+bool IRSink::close()
+{
+	if (target == TO_COPY) {
+		size_t n = size();
+		bool ok = n == 0 || copy_mapped(n) || copy_written(n);
+		if (!ok)
+			fprintf(stderr, "cannot write output file: %s\n", strerror(errno));
+		ok = ::close(fd) == 0 && ok;
+		fd = -1;
+		target = TO_MEMORY;
+		setp(buf, buf + cap);
+		return ok;
+	}
+	flush();
+	if (target == TO_FILE)
+		return fflush(file) == 0 && !ferror(file);
+	if (target == TO_STREAM)
+		return (bool) down->flush();
+	return true;
+}
+
+IRSink::int_type IRSink::overflow(int_type c)
+{
+	if (c != traits_type::eof())
+		append((char) c);
+	return traits_type::not_eof(c);
+}
+
+std::streamsize IRSink::xsputn(const char *s, std::streamsize n)
+{
+	append(s, n);
+	return n;
+}
+
+int IRSink::sync()
+{
+	return 0;
+}
@@ -0,0 +1,76 @@
+/* IRSink
+ * Append-only output buffer for the generated LLVM assembly.  It is also a
+ * streambuf, so an ostream built on it can be handed to code that only
+ * knows about ostreams; ValuePrinter notices the sink behind the stream and
+ * appends to it directly, without ostream formatting or locales.
+ */
+
+#ifndef __IR_SINK_H
+#define __IR_SINK_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <streambuf>
+#include <ostream>
+
+using std::string;
+using std::ostream;
+
+class IRSink : public std::streambuf {
+	private:
+		typedef enum {TO_MEMORY, TO_FILE, TO_STREAM, TO_COPY} sink_target;
+		sink_target target;
+		FILE *file;
+		ostream *down;
+		int fd;
+		char *buf;
+		size_t cap;
+
+		void reserve(size_t n);
+		bool copy_mapped(size_t n);
+		bool copy_written(size_t n);
+
+	protected:
+		/* streambuf hooks for output made through an ostream */
+		int_type overflow(int_type c);
+		std::streamsize xsputn(const char *s, std::streamsize n);
+		int sync();
+
+	public:
+		/* Everything stays in memory until a target is opened */
+		IRSink(size_t reserved = 1 << 20);
+		~IRSink();
+
+		/* Flushed with fwrite in chunks of the reserved size */
+		void open_file(FILE *f);
+		/* Flushed with ostream::write in chunks of the reserved size */
+		void open_stream(ostream &o);
+		/* Kept in memory until close(), then copied into the file at
+		 * once: through a shared mapping, or with write() if the file
+		 * cannot be mapped */
+		bool open_copy(const char *path);
+
+		void append(const char *s, size_t n)
+		  { if ((size_t) (epptr() - pptr()) < n) reserve(n);
+		    memcpy(pptr(), s, n); advance(n); }
+		void append(const char *s) { append(s, strlen(s)); }
+		void append(const string &s) { append(s.data(), s.size()); }
+		void append(char c)
+		  { if (pptr() == epptr()) reserve(1); *pptr() = c; pbump(1); }
+		void append_int(long v);
+
+		/* Bytes buffered and not yet flushed */
+		const char *data() { return pbase(); }
+		size_t size() { return pptr() - pbase(); }
+
+		void flush();
+		/* Flushes what is buffered; false if it could not be written */
+		bool close();
+
+	private:
+		void advance(size_t n)
+		  { while (n > (1u << 30)) { pbump(1 << 30); n -= 1 << 30; } pbump((int) n); }
+};
+
+#endif
@@ -0,0 +1,72 @@
+//
+// Throughput of the IR output path: emits a synthetic module through
+// ValuePrinter, once into an IRSink and once into a plain ostringstream,
+// and reports MB/s for each.
+//
+//     irbench [functions] [instructions per function]
+//
+
+#include "value_printer.h"
+#include "ir_sink.h"
+#include <sstream>
+#include <iostream>
+#include <chrono>
+
+void reset_fresh_operands();
+
+static void emit_module(ostream &o, int nfuncs, int ninsts)
+{
+	ValuePrinter vp(o);
+	op_type i32(INT32);
+	vector<operand> args;
+	args.push_back(operand(i32, "x"));
+	for (int f = 0; f < nfuncs; f++) {
+		reset_fresh_operands();
+		vp.define(i32, "f" + itos(f), args);
+		vp.begin_block("entry");
+		operand slot = vp.alloca_mem(i32);
+		vp.store(args[0], slot);
+		operand v = vp.load(i32, slot);
+		for (int i = 0; i < ninsts; i++) {
+			operand w = vp.add(v, int_value(i));
+			operand c = vp.icmp(LT, w, int_value(1000));
+			vp.store(vp.select(c, w, v), slot);
+			v = vp.load(i32, slot);
+		}
+		vp.ret(v);
+		vp.end_define();
+	}
+}
+
+static void report(const char *what, size_t bytes, double secs)
+{
+	std::cout << what << ": " << bytes / 1e6 << " MB in " << secs << " s, "
+		<< bytes / 1e6 / secs << " MB/s" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	int nfuncs = argc > 1 ? atoi(argv[1]) : 2000;
+	int ninsts = argc > 2 ? atoi(argv[2]) : 500;
+	typedef std::chrono::steady_clock clock;
+
+	FILE *null = fopen("/dev/null", "w");
+	IRSink sink;
+	sink.open_file(null);
+	ostream s(&sink);
+	size_t bytes = 0;
+	clock::time_point t0 = clock::now();
+	emit_module(s, nfuncs, ninsts);
+	sink.close();
+	clock::time_point t1 = clock::now();
+
+	std::ostringstream plain;
+	emit_module(plain, nfuncs, ninsts);
+	clock::time_point t2 = clock::now();
+	bytes = plain.str().size();
+
+	report("IRSink", bytes, std::chrono::duration<double>(t1 - t0).count());
+	report("ostringstream", bytes, std::chrono::duration<double>(t2 - t1).count());
+	fclose(null);
+	return 0;
+}
@@ -1,71 +1,96 @@
 #include "operand.h"
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
-op_type::op_type(op_type_id i) : id(i){
-	switch (id) {
-		case EMPTY:
-			name = "";
-			break;
-		case VOID:
-			name = "void";
-			break;
-		case INT1:
-			name = "i1";
-			break;
-		case INT8:
-			name = "i8";
-			break;
-		case INT32:
-			name = "i32";
-			break;
-		case INT1_PTR:
-			name = "i1*";
-			break;
-		case INT8_PTR:
-			name = "i8*";
-			break;
-		case INT32_PTR:
-			name = "i32*";
-			break;
-		case INT1_PPTR:
-			name = "i1**";
-			break;
-		case INT8_PPTR:
-			name = "i8**";
-			break;
-		case INT32_PPTR:
-			name = "i32**";
-			break;
-		case VAR_ARG:
-			name = "...";
-			break;
-		case OBJ:
-		case OBJ_PTR:
-		case OBJ_PPTR:
-			break;
-		default:
-			assert(0 && "Variable type not implemented");
-			
-	}
+// Type spellings are compared by address, so there is one table for all
+// threads.  It only holds types, which are few; each thread keeps a cache
+// of the entries it has seen and takes the lock on a miss.  Both tables
+// are node based: an entry never moves once inserted.
+static std::mutex type_lock;
+
+const string *intern_type(const string &s)
+{
+	static std::unordered_set<string> names;
+	static thread_local std::unordered_map<string,const string*> seen;
+	std::unordered_map<string,const string*>::iterator it = seen.find(s);
+	if (it != seen.end())
+		return it->second;
+	std::lock_guard<std::mutex> guard(type_lock);
+	const string *n = &*names.insert(s).first;
+	seen[s] = n;
+	return n;
 }
 
-op_type::op_type(string n, int ptr_level) {
-	name = "%" + n;
-	id = OBJ;
-	// Pointer to an object
-	if (ptr_level == 1) {
-		name += "*";
-		id = OBJ_PTR;
-	}
-	// Pointer to a pointer to an object;
-	if (ptr_level == 2) {
-		id = OBJ_PPTR;
-		name += "**";
+const op_class_name *intern_class(const string &class_name)
+{
+	static std::unordered_map<string,op_class_name> classes;
+	static thread_local std::unordered_map<string,const op_class_name*> seen;
+	std::unordered_map<string,const op_class_name*>::iterator it = 
+		seen.find(class_name);
+	if (it != seen.end())
+		return it->second;
+	std::lock_guard<std::mutex> guard(type_lock);
+	std::unordered_map<string,op_class_name>::iterator c = 
+		classes.find(class_name);
+	if (c == classes.end()) {
+		c = classes.insert(std::make_pair(class_name, op_class_name())).first;
+		c->second.spelling[0] = "%" + class_name;
+		c->second.spelling[1] = c->second.spelling[0] + "*";
+		c->second.spelling[2] = c->second.spelling[0] + "**";
 	}
+	seen[class_name] = &c->second;
+	return &c->second;
+}
+
+// Operand spellings are only printed.  Each thread has its own table,
+// freed when the thread exits, so names need no lock.
+const string *intern_name(const string &s)
+{
+	static thread_local std::unordered_set<string> names;
+	return &*names.insert(s).first;
+}
+
+// Spelling of each non-class type id, indexed by op_type_id
+static const string *primitive_name(op_type_id i)
+{
+	static const string *names[OBJ] = {
+		intern_type(""), intern_type("void"), 
+		intern_type("i1"), intern_type("i1*"), intern_type("i1**"),
+		intern_type("i8"), intern_type("i8*"), intern_type("i8**"),
+		intern_type("i32"), intern_type("i32*"), intern_type("i32**"),
+		intern_type("...")
+	};
+	return names[i];
+}
 
+op_type::op_type(op_type_id i) : id(i), cls(NULL) {
+	if (i < OBJ)
+		name = primitive_name(i);
+	else if (i <= OBJ_PPTR)
+		name = intern_type("");
+	else
+		assert(0 && "Variable type not implemented");
+}
+
+op_type::op_type(string n, int ptr_level) {
 	if (ptr_level > 2 || ptr_level < 0)
 		assert(0 && "Invalid pointer level");
+	set_class(intern_class(n), (op_type_id) (OBJ + ptr_level));
 }	
 
+string operand::get_name()
+{
+	switch (kind) {
+		case OP_TEMP:
+			return "%vtpm." + itos(num);
+		case OP_NAMED:
+			return *spelling;
+		default:
+			return "";
+	}
+}
+
 /* Get a pointer type of the current type
  */
 op_type op_type::get_ptr_type() {
@@ -98,16 +123,9 @@ op_type op_type::get_ptr_type() {
 		default:
 			assert(0 && "get_ptr_type(): Type unsupported");
 	}
-	op_type ptr_type;
-	if (ptr_id == OBJ_PTR || ptr_id == OBJ_PPTR) {
-		op_type new_type(string(name.c_str() + 1), 1);
-		new_type.set_id(ptr_id);
-		ptr_type = new_type;
-	}
-	else {
-		op_type new_type(ptr_id);
-		ptr_type = new_type;
-	}
+	op_type ptr_type(ptr_id);
+	if (cls)
+		ptr_type.set_class(cls, ptr_id);
 	return ptr_type;
 }
 
@@ -143,55 +161,50 @@ op_type op_type::get_deref_type() {
 		default:
 			assert(0 && "get_deref_type(): Cannot get type after dereferencing");
 	}
-	op_type deref_type;
-	if (deref_id == OBJ || deref_id == OBJ_PTR) {
-		//char *new_name = name.c_str() + 1;
-		//new_name[strlen(new_name) - 1] = '\0';
-		string new_name = name.substr(1, name.length() - 2);
-		op_type new_type(new_name);
-		new_type.set_id(deref_id);
-		deref_type = new_type;
-	}
-	else {
-		op_type new_type(deref_id);
-		deref_type = new_type;
-	}
+	op_type deref_type(deref_id);
+	if (cls)
+		deref_type.set_class(cls, deref_id);
 	return deref_type;
 }
 
 /* Construct the type name for an array type from the size and base type name */
 static string arrayTypeName(int size, const string& type_name)
 {
-  string size_str = " ";
-  for (int j = size; j > 9; j %= 10)
-    size_str += " ";
-  string arrayTypeName = "[" + itoa(size, size_str) + " x " + type_name + "]";
-  return arrayTypeName;
+  return "[" + itos(size) + " x " + type_name + "]";
 }
 
 /* Array type
  * Format: [size x type]
  */
 op_arr_type::op_arr_type(op_type_id i, int s) : op_type(i), size(s) {
-	name = arrayTypeName(s, name);
+	name = intern_type(arrayTypeName(s, *name));
 };
 op_arr_ptr_type::op_arr_ptr_type(op_type_id i, int s) : op_type(i), size(s) {
-	name = arrayTypeName(s, name) + '*';
+	name = intern_type(arrayTypeName(s, *name) + '*');
+};
+
+/* Arrays of objects, e.g. [4 x %Int] */
+op_arr_type::op_arr_type(op_type t, int s) : op_type(t.get_id()), size(s) {
+	name = intern_type(arrayTypeName(s, t.get_name()));
+};
+op_arr_ptr_type::op_arr_ptr_type(op_type t, int s) : op_type(t.get_id()), size(s) {
+	name = intern_type(arrayTypeName(s, t.get_name()) + '*');
 };
 
 /* Function and Function pointer types */
 op_func_type::op_func_type(op_type res_type, vector<op_type> arg_types)
   : op_type(EMPTY), res(res_type), args(arg_types)
 {
-	name = string(res_type.get_name() + " (");
+	string n = res_type.get_name() + " (";
 	if (arg_types.size() == 0)
-		name.append(") *");
+		n.append(") *");
 	else {
 		unsigned i;
 		for (i = 0; i < arg_types.size()-1; i++)
-			name.append(arg_types[i].get_name() + ",");
-		name.append(arg_types[i].get_name() + ") *");
+			n.append(arg_types[i].get_name() + ",");
+		n.append(arg_types[i].get_name() + ") *");
 	}
+	name = intern_type(n);
 }
 
 op_type op_func_type::get_ptr_type() { return op_func_ptr_type(res, args); }
@@ -204,7 +217,7 @@ op_func_ptr_type::op_func_ptr_type(op_type res_type, vector<op_type> arg_types)
   : op_type(EMPTY), res(res_type), args(arg_types)
 {
 	op_func_type func_type(res_type, arg_types);
-	name = string(func_type.get_name() + "*");
+	name = intern_type(func_type.get_name() + "*");
 }
 
 op_type op_func_ptr_type::get_ptr_type() {
@@ -23,22 +23,45 @@ typedef enum {EMPTY, VOID, INT1, INT1_PTR, INT1_PPTR, INT8, INT8_PTR, INT8_PPTR,
 	      INT32, INT32_PTR, INT32_PPTR, VAR_ARG, 
 /* Types needed for MP2.2 */ OBJ, OBJ_PTR, OBJ_PPTR} op_type_id;
 
+/* Spellings of a class type at pointer depth 0, 1 and 2.  There is one
+ * record per class name, shared by every op_type that refers to the class,
+ * so comparing class types is a pointer compare.
+ */
+struct op_class_name {
+	string spelling[3];
+};
+
+/* Interned type spellings live for the whole run and may be compared by
+ * address.  Operand spellings are interned per thread: an operand must not
+ * outlive the thread that made it.
+ */
+const string *intern_type(const string &s);
+const op_class_name *intern_class(const string &class_name);
+const string *intern_name(const string &s);
+
+/* An op_type is an id plus an interned spelling: the class record for
+ * OBJ, OBJ_PTR and OBJ_PPTR, the full type for arrays and functions.
+ * Copying one never copies a string.
+ */
 class op_type {
 	protected:
 		op_type_id id;
-		/* LLVM string representation of a type */
-		string name;
+		const op_class_name *cls;
+		const string *name;
+		void set_class(const op_class_name *c, op_type_id i)
+		  { cls = c; id = i; name = &c->spelling[i - OBJ]; }
 	public:
-		op_type() : id(EMPTY), name(""){}
+		op_type() : id(EMPTY), cls(NULL), name(intern_type("")) {}
 		op_type(op_type_id i);
-		op_type(string n) : id(OBJ), name("%" + n) {}
+		op_type(string n) { set_class(intern_class(n), OBJ); }
 		op_type(string n, int ptr_level);
 		op_type_id get_id() { return id; }
-		void set_id(op_type_id i) { id = i; }
-		void set_type(op_type t) 
-		  { id = t.get_id(); name = t.get_name(); }
-		string get_name() { return name; }
-    string get_ptr_type_name() { return name + "*"; }
+		void set_id(op_type_id i) 
+		  { if (cls && i >= OBJ) set_class(cls, i); else id = i; }
+		void set_type(op_type t) { *this = t; }
+		string get_name() { return *name; }
+		const string &get_spelling() { return *name; }
+    string get_ptr_type_name() { return *name + "*"; }
 		bool is_ptr() 
 		  { return (id == INT1_PTR || id == INT8_PTR || 
 		            id == INT32_PTR || id == OBJ_PTR); }
@@ -49,15 +72,19 @@ class op_type {
 		  { return (id == INT1_PPTR || id == INT8_PPTR ||
 		            id == INT32_PPTR || id == OBJ_PPTR); }
 		bool is_int_object()
-		  { return id == OBJ_PTR && name.compare("%Int*")==0; }
+		  { static const op_class_name *c = intern_class("Int");
+		    return id == OBJ_PTR && cls == c; }
 		bool is_bool_object()
-		  { return id == OBJ_PTR && name.compare("%Bool*")==0; }
+		  { static const op_class_name *c = intern_class("Bool");
+		    return id == OBJ_PTR && cls == c; }
 		bool is_string_object()
-		  { return id == OBJ_PTR && name.compare("%String*")==0; }
+		  { static const op_class_name *c = intern_class("String");
+		    return id == OBJ_PTR && cls == c; }
 		bool is_self_type()
-		  { return id == OBJ && name.compare("%SELF_TYPE")==0; }
+		  { static const op_class_name *c = intern_class("SELF_TYPE");
+		    return id == OBJ && cls == c; }
 		bool is_same_with(op_type t)
-		  { return name.compare(t.get_name())==0; }
+		  { return name == t.name; }
 };
 
 /* Pointer-to-array type */
@@ -66,10 +93,11 @@ class op_arr_ptr_type : public op_type {
 		int size;
 	public:
 		op_arr_ptr_type(op_type_id, int);
+		op_arr_ptr_type(op_type, int);
 		op_type get_ptr_type() = delete;    // unsupported operation
 		int get_size() { return size; }
 		op_type_id get_id() { return id; }
-		string get_name() { return name; }
+		string get_name() { return *name; }
 };
  
 /* Arrays are derived from op_type */
@@ -78,7 +106,9 @@ class op_arr_type : public op_type {
 		int size;
 	public:
 		op_arr_type(op_type_id, int);
-		op_type get_ptr_type() { return op_arr_ptr_type(id, size) ; }
+		op_arr_type(op_type, int);
+		op_type get_ptr_type()
+		  { op_arr_type p(*this); p.name = intern_type(*name + "*"); return p; }
 		int get_size() { return size; }
 		op_type_id get_id() { return id; }
 };
@@ -90,6 +120,8 @@ class op_func_type : public op_type {
 		vector<op_type> args;
 	public:
 		op_func_type(op_type res_type, vector<op_type> arg_types);
+		op_type get_result_type() { return res; }
+		vector<op_type> get_arg_types() { return args; }
 		bool is_ptr() { return false; }
 		op_type get_ptr_type();
 		op_type get_deref_type();
@@ -109,20 +141,35 @@ class op_func_ptr_type : public op_type {
 };
 
 
+/* Fresh temporaries are only an SSA number and become "%vtpm.<n>" when
+ * printed; every other operand keeps its interned spelling.
+ */
+typedef enum {OP_NONE, OP_TEMP, OP_NAMED} operand_kind;
+
 class operand {
 	protected:
 		op_type type;
-		string name;
+		operand_kind kind;
+		int num;
+		const string *spelling;
+		void set_spelling(const string &s)
+		  { kind = OP_NAMED; spelling = intern_name(s); }
 	public:
 
-		operand() : type(EMPTY), name("") { }
-		operand(const operand& other)
-		  : type(other.type), name(other.name) {}
-		operand(op_type t, string n) : type(t), name("%" + n) {}
+		operand() : type(EMPTY), kind(OP_NONE), num(0), spelling(NULL) { }
+		operand(op_type t, string n) : type(t), num(0) 
+		  { set_spelling("%" + n); }
+		operand(op_type t, int ssa)
+		  : type(t), kind(OP_TEMP), num(ssa), spelling(NULL) { }
 		op_type get_type() { return type; }
 		void set_type(op_type t) { type = t; }
 		string get_typename() { return type.get_name(); }
-		string get_name () { return name; }
+		string get_name();
+		/* Spelling of a non-temporary operand, without a copy */
+		const string &get_spelling()
+		  { static const string none; return spelling ? *spelling : none; }
+		bool is_temp() { return kind == OP_TEMP; }
+		int get_ssa_number() { return num; }
 		bool is_empty() { return type.get_id() == EMPTY; }
 };
 
@@ -131,8 +178,8 @@ class global_value : public operand {
 		operand value;
 	public:
 		global_value(op_type t, string n, operand v) 
-		  { type = t; name = "@" + n; value = v;}
-		global_value(op_type t, string n) { type = t; name = "@" + n;}
+		  { type = t; set_spelling("@" + n); value = v;}
+		global_value(op_type t, string n) { type = t; set_spelling("@" + n);}
 		operand get_value() { return value; }
 };
 
@@ -142,7 +189,7 @@ class const_value : public operand {
 		bool internal;
 	public:
 		const_value(op_type t, string val, bool intr)
-		  : value(val), internal(intr) { type = t; name = value; }
+		  : value(val), internal(intr) { type = t; set_spelling(value); }
 		bool is_internal() { return internal; }
 		string get_value() { return value; }
 };
@@ -174,8 +221,8 @@ class bool_value : public const_value {
 		bool b_value;
 	public:
 		bool_value(bool b, bool intr)
-		  : const_value(op_type(INT1), "", intr), b_value(b)
-		  { if (b) value = "true"; else value = "false"; name = value;}
+		  : const_value(op_type(INT1), b ? "true" : "false", intr), 
+		    b_value(b) {}
 		int get_boolvalue() { return b_value; }
 };
 
@@ -0,0 +1,160 @@
+#include "optimizer.h"
+#include <assert.h>
+#include <iostream>
+
+#ifdef HAVE_LLVM
+#include "llvm/Config/llvm-config.h"
+#endif
+
+// The pipelines below need the new pass manager's textual syntax
+#if defined(HAVE_LLVM) && LLVM_VERSION_MAJOR >= 13
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IR/PassTimingInfo.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+//
+// Pipelines for each level, in PassBuilder's textual syntax.
+//
+// Cool code is dominated by allocas for every let and formal, calls
+// through vtables that are constant globals, and small methods.  So the
+// tuned levels promote memory first, let GVN and instcombine fold vtable
+// loads into direct calls, and run the inliner under devirt<> so that a
+// call which has just become direct is inlined in the same pass.
+//
+static const char *const pipelines[] = {
+	// -O0: nothing, -runtime still links
+	"",
+	// -O1: registers and local cleanup only
+	"function(sroa,mem2reg,instcombine,simplifycfg,early-cse)",
+	// -O2
+	"function(sroa,mem2reg,instcombine,simplifycfg,early-cse<memssa>),"
+	"ipsccp,globalopt,function(instcombine),"
+	"cgscc(devirt<4>(inline,function-attrs,"
+		"function(sroa,early-cse<memssa>,instcombine,simplifycfg,gvn,"
+		"loop-mssa(licm),instcombine,simplifycfg,dse,adce))),"
+	"globaldce,constmerge",
+	// -O3: LLVM's own full pipeline
+	"default<O3>",
+};
+
+// Facts about runtime functions that LLVM cannot see from a declaration,
+// and that are cheaper to state than to infer
+static const struct {
+	const char *name;
+	llvm::Attribute::AttrKind attr;
+} runtime_attrs[] = {
+	{ "Object_abort", llvm::Attribute::NoReturn },
+	{ "Object_abort", llvm::Attribute::Cold },
+	{ "String_length", llvm::Attribute::ReadOnly },
+	{ "String_length", llvm::Attribute::WillReturn },
+	// Runs once per heap chunk; keep it out of the inlined fast path
+	{ "cool_alloc_slow", llvm::Attribute::Cold },
+	{ "cool_alloc_slow", llvm::Attribute::NoInline },
+};
+
+// Whole-program link: everything except main becomes internal, so the
+// optimizer may inline, specialize or drop any runtime function
+static bool link_runtime(llvm::Module &module, const char *runtime)
+{
+	llvm::SMDiagnostic diag;
+	std::unique_ptr<llvm::Module> rt = 
+		llvm::parseIRFile(runtime, diag, module.getContext());
+	if (!rt) {
+		diag.print("cgen", llvm::errs());
+		return false;
+	}
+	if (llvm::Linker::linkModules(module, std::move(rt))) {
+		llvm::errs() << "cgen: cannot link " << runtime << "\n";
+		return false;
+	}
+
+	for (llvm::Function &f : module) {
+		// Cool has no exceptions and the runtime is plain C
+		f.addFnAttr(llvm::Attribute::NoUnwind);
+		if (!f.isDeclaration() && f.getName() != "main")
+			f.setLinkage(llvm::GlobalValue::InternalLinkage);
+	}
+	for (llvm::GlobalVariable &g : module.globals())
+		if (!g.isDeclaration())
+			g.setLinkage(llvm::GlobalValue::InternalLinkage);
+	for (unsigned i = 0; i < sizeof(runtime_attrs) / sizeof(runtime_attrs[0]); i++)
+		if (llvm::Function *f = module.getFunction(runtime_attrs[i].name))
+			f->addFnAttr(runtime_attrs[i].attr);
+	return true;
+}
+
+bool optimize_ir(const char *ir, size_t len, int level, const char *runtime,
+	bool time_passes, std::string &out)
+{
+	if (level <= 0 && !runtime)
+		return false;
+	if (level > 3)
+		level = 3;
+	assert(level < (int) (sizeof(pipelines) / sizeof(pipelines[0])));
+
+	llvm::LLVMContext context;
+	llvm::SMDiagnostic diag;
+	std::unique_ptr<llvm::Module> module = llvm::parseIR(
+		llvm::MemoryBufferRef(llvm::StringRef(ir, len), "cool"), diag, context);
+	if (!module) {
+		diag.print("cgen", llvm::errs());
+		return false;
+	}
+
+	if (runtime && !link_runtime(*module, runtime))
+		return false;
+
+	llvm::PassInstrumentationCallbacks callbacks;
+	llvm::TimePassesHandler timer(time_passes);
+	timer.registerCallbacks(callbacks);
+
+	llvm::PassBuilder builder(nullptr, llvm::PipelineTuningOptions(),
+		{}, &callbacks);
+	llvm::LoopAnalysisManager lam;
+	llvm::FunctionAnalysisManager fam;
+	llvm::CGSCCAnalysisManager cgam;
+	llvm::ModuleAnalysisManager mam;
+	builder.registerModuleAnalyses(mam);
+	builder.registerCGSCCAnalyses(cgam);
+	builder.registerFunctionAnalyses(fam);
+	builder.registerLoopAnalyses(lam);
+	builder.crossRegisterProxies(lam, fam, cgam, mam);
+
+	llvm::ModulePassManager passes;
+	// -O0 with -runtime links without running any pass
+	llvm::Error err = level > 0
+		? builder.parsePassPipeline(passes, pipelines[level])
+		: llvm::Error::success();
+	if (err) {
+		llvm::errs() << "cgen: bad pipeline for -O" << level << ": " 
+			<< llvm::toString(std::move(err)) << "\n";
+		return false;
+	}
+	passes.run(*module, mam);
+	if (time_passes)
+		timer.print();
+
+	llvm::raw_string_ostream s(out);
+	module->print(s, nullptr);
+	s.flush();
+	return true;
+}
+
+#else
+
+bool optimize_ir(const char *ir, size_t len, int level, const char *runtime,
+	bool time_passes, std::string &out)
+{
+	if (level > 0 || runtime)
+		std::cerr << "cgen: built without LLVM 13 or later, -O and -runtime ignored" << std::endl;
+	return false;
+}
+
+#endif
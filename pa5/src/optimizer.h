@@ -0,0 +1,23 @@
+/* In-process LLVM optimization of the generated module.
+ * The code generator still produces LLVM assembly text; when an
+ * optimization level is selected the text is parsed back with the LLVM
+ * libraries, run through the pipeline for that level and printed again.
+ */
+
+#ifndef __OPTIMIZER_H
+#define __OPTIMIZER_H
+
+#include <stddef.h>
+#include <string>
+
+/* Run the -O<level> pipeline over the module in ir[0..len) and leave the
+ * optimized module in out.  When runtime names a bitcode file it is
+ * linked in first and every function except main is made internal.
+ * Returns false, with out untouched, if the module does not parse or
+ * link, or the compiler was built without LLVM.  With time_passes a
+ * per-pass timing report is printed to stderr.
+ */
+bool optimize_ir(const char *ir, size_t len, int level, const char *runtime,
+	bool time_passes, std::string &out);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Cost of String_substr in the scanning loops of Cool parsers, over a
+ * line of comma-separated numbers:
+ *
+ *   chars   substr(i, 1) for every char
+ *   fields  substr(i, 8) for every 8-char field of each 64-char
+ *           record, then substr(j, 1) over the field
+ *   tails   s <- s.substr(1, s.length() - 1) until s is empty, on the
+ *           first 64k chars
+ *
+ * and reports the time per substr call.
+ *
+ *     strbench [chars]
+ */
+
+#include "coolrt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static String *make_input(int len)
+{
+	char *val = cool_alloc_raw(len);
+	for (int i = 0; i < len; i++)
+		val[i] = i % 8 == 7 ? ',' : '0' + (i * 7 + i / 8) % 10;
+	String *s = String_new();
+	s->val = val;
+	s->len = len;
+	return s;
+}
+
+/* Sum of the numbers read a char at a time, as atoi.cl does */
+static long scan(String *s, long *calls)
+{
+	long sum = 0, n = 0;
+	for (int i = 0; i < s->len; i++) {
+		String *c = String_substr(s, i, 1);
+		char ch = c->val[c->offset];
+		if (ch == ',') {
+			sum += n;
+			n = 0;
+		} else
+			n = n * 10 + ch - '0';
+	}
+	*calls += s->len;
+	return sum + n;
+}
+
+static void report(const char *what, long calls, double secs, long check)
+{
+	printf("%-7s %10ld calls in %.3f s, %6.1f ns per substr (%ld)\n", 
+		what, calls, secs, secs * 1e9 / calls, check);
+}
+
+int main(int argc, char *argv[])
+{
+	int len = argc > 1 ? atoi(argv[1]) : 16 << 20;
+	String *input = make_input(len);
+	long calls, sum;
+	double t;
+
+	calls = 0;
+	t = now();
+	sum = scan(input, &calls);
+	report("chars", calls, now() - t, sum);
+
+	calls = 0;
+	sum = 0;
+	t = now();
+	for (int r = 0; r + 64 <= len; r += 64) {
+		String *record = String_substr(input, r, 64);
+		for (int f = 0; f < 64; f += 8)
+			sum += scan(String_substr(record, f, 8), &calls);
+		calls += 9;
+	}
+	report("fields", calls, now() - t, sum);
+
+	String *s = String_substr(input, 0, len < 65536 ? len : 65536);
+	calls = 0;
+	t = now();
+	while (s->len > 0) {
+		s = String_substr(s, 1, s->len - 1);
+		calls++;
+	}
+	report("tails", calls, now() - t, s->len);
+	return 0;
+}
@@ -13,7 +13,8 @@ class CgenClassTable;
 // 
 #define StringEntry_EXTRAS \
   void code_def(ostream& str, CgenClassTable *classTable); \
-  void code_ref(ostream& str, CgenClassTable *classTable);
+  void code_ref(ostream& str, CgenClassTable *classTable); \
+  int get_index() const { return index; }
 
 #define IntEntry_EXTRAS \
   void code_def(ostream& str, CgenClassTable *classTable); \
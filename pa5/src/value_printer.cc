@@ -1,15 +1,41 @@
 #include "value_printer.h"
+#include "ir_sink.h"
 #include "cool-io.h"     // for cerr, <<, manipulators
 #include <sstream>
 
-static int value_printer_counter = 0;
-static void embed_getelementptr (ostream &o, op_type type, operand op1, operand op2, operand op3);
+// Fresh names are function-local, so each code generation thread keeps
+// its own counter
+static thread_local int value_printer_counter = 0;
+
+// Output of one instruction.  When the stream is backed by an IRSink the
+// text is appended to it directly, otherwise it goes through the ostream.
+// Operands are rendered here, so a temporary never becomes a string.
+class ir_out {
+	private:
+		IRSink *sink;
+		ostream &o;
+	public:
+		ir_out(ostream &os) : sink(dynamic_cast<IRSink*>(os.rdbuf())), o(os) {}
+		ir_out &operator<<(const char *s)
+		  { if (sink) sink->append(s); else o << s; return *this; }
+		ir_out &operator<<(const string &s)
+		  { if (sink) sink->append(s); else o << s; return *this; }
+		ir_out &operator<<(int v)
+		  { if (sink) sink->append_int(v); else o << v; return *this; }
+		ir_out &operator<<(op_type t) { return *this << t.get_spelling(); }
+		ir_out &operator<<(operand op)
+		  { if (op.is_temp()) return *this << "%vtpm." << op.get_ssa_number();
+		    return *this << op.get_spelling(); }
+};
+
+static void embed_getelementptr (ir_out &o, op_type type, operand op1, operand op2, operand op3);
+
+void reset_fresh_operands() {
+	value_printer_counter = 0;
+}
 
 operand make_fresh_operand(op_type type) {
-	stringstream out;
-	out << "vtpm." << (value_printer_counter++);
-	string name = out.str();
- 	return operand(type, name);
+ 	return operand(type, value_printer_counter++);
 }
 
 void my_print_escaped_string(ostream& str, const char *s)
@@ -46,16 +72,22 @@ void my_print_escaped_string(ostream& str, const char *s)
  * Format: @name = [internal] constant type value
  */
 void ValuePrinter::init_constant(ostream &o, string name, const_value op) {
-	o << "@" + name + " = " + (op.is_internal() ? "internal " : "") 
-	  + "constant " + op.get_typename() + " ";
+	ir_out out(o);
+	out << "@" << name << " = " << (op.is_internal() ? "internal " : "") 
+	  << "constant " << op.get_type() << " ";
 	if (op.get_type().get_id() == INT8) {
-		o << "c\"";
-		my_print_escaped_string(o, op.get_value().c_str());
-		o << "\\00\"";
+		// Embedded NULs separate strings packed into one array
+		string v = op.get_value();
+		out << "c\"";
+		for (size_t p = 0; p <= v.size(); p += strlen(v.c_str() + p) + 1) {
+			my_print_escaped_string(o, v.c_str() + p);
+			out << "\\00";
+		}
+		out << "\"";
   	}
 	else
-		o << op.get_value();
-	o << "\n";
+		out << op.get_value();
+	out << "\n";
 }
 
 void ValuePrinter::init_constant(string name, const_value op) {
@@ -64,8 +96,8 @@ void ValuePrinter::init_constant(string name, const_value op) {
 }
 
 void ValuePrinter::init_ext_constant(ostream &o, string name, op_type type) {
-	o << "@" + name + " = " + "external constant " 
-	  + type.get_name() + "\n";
+	ir_out out(o);
+	out << "@" << name << " = external constant " << type << "\n";
 }
 
 void ValuePrinter::init_ext_constant(string name, op_type type) {
@@ -73,34 +105,84 @@ void ValuePrinter::init_ext_constant(string name, op_type type) {
 	init_ext_constant(*stream, name, type);
 }
 
+/* Format: @name = external [thread_local] global type */
+void ValuePrinter::init_ext_global(ostream &o, string name, op_type type,
+		bool tls) {
+	ir_out out(o);
+	out << "@" << name << " = external " << (tls ? "thread_local " : "")
+	  << "global " << type << "\n";
+}
+
+void ValuePrinter::init_ext_global(string name, op_type type, bool tls) {
+	check_ostream();
+	init_ext_global(*stream, name, type, tls);
+}
+
 /* Function definition
- * Format: define return_type function_name(args) {
+ * Format: define [internal] [fastcc] [ret_attrs] return_type function_name(args) [fn_attrs] [gc "name"] {
  * Note: Must terminate the function definition with a "}" or by using end_define() after
  * printing all the instructions in a function body.
  */
-void ValuePrinter::define(ostream &o, op_type ret_type, string name, vector<operand> args) {
+static void print_prefix(ir_out &out, const func_attrs &attrs)
+{
+	if (attrs.internal)
+		out << "internal ";
+	if (attrs.cc == FASTCC)
+		out << "fastcc ";
+	if (!attrs.ret.empty())
+		out << attrs.ret << " ";
+}
+
+static void print_param_attrs(ir_out &out, const func_attrs &attrs, unsigned i)
+{
+	if (i < attrs.params.size() && !attrs.params[i].empty())
+		out << " " << attrs.params[i];
+}
+
+void ValuePrinter::define(ostream &o, op_type ret_type, string name, vector<operand> args,
+		const func_attrs &attrs) {
 	check_ostream(o);
-	o << "define " + ret_type.get_name() + " @" + name + "(";
-	for (unsigned i = 0; i < args.size(); ++i)
-		o << args[i].get_typename() + " " + args[i].get_name()  +  (i + 1 < args.size() ? ", " : "");
-	o << ") {\n";
+	ir_out out(o);
+	out << "define ";
+	print_prefix(out, attrs);
+	out << ret_type << " @" << name << "(";
+	for (unsigned i = 0; i < args.size(); ++i) {
+		out << args[i].get_type();
+		print_param_attrs(out, attrs, i);
+		out << " " << args[i] << (i + 1 < args.size() ? ", " : "");
+	}
+	out << ")" << (attrs.fn.empty() ? "" : " ") << attrs.fn;
+	if (!attrs.gc.empty())
+		out << " gc \"" << attrs.gc << "\"";
+	out << " {\n";
 }
-void ValuePrinter::define(op_type ret_type, string name, vector<operand> args) {
-	define(*stream, ret_type, name, args);
+void ValuePrinter::define(op_type ret_type, string name, vector<operand> args,
+		const func_attrs &attrs) {
+	define(*stream, ret_type, name, args, attrs);
 }
 
 /* Function declaration
- * Format: declare return_type function_name(arg_types)
+ * Format: declare [ret_attrs] return_type function_name(arg_types) [fn_attrs]
+ * Linkage is ignored, declarations are always external.
  */
-void ValuePrinter::declare(ostream &o, op_type ret_type, string name, vector<op_type> args) {
+void ValuePrinter::declare(ostream &o, op_type ret_type, string name, vector<op_type> args,
+		const func_attrs &attrs) {
 	check_ostream(o);
-	o << "declare " + ret_type.get_name() + " @" + name + "(";
-	for (unsigned i = 0; i < args.size(); ++i)
-		o << args[i].get_name()  +  (i + 1 < args.size() ? ", " : "");
-	o << ")\n";
+	ir_out out(o);
+	out << "declare " << (attrs.cc == FASTCC ? "fastcc " : "");
+	if (!attrs.ret.empty())
+		out << attrs.ret << " ";
+	out << ret_type << " @" << name << "(";
+	for (unsigned i = 0; i < args.size(); ++i) {
+		out << args[i];
+		print_param_attrs(out, attrs, i);
+		out << (i + 1 < args.size() ? ", " : "");
+	}
+	out << ")" << (attrs.fn.empty() ? "" : " ") << attrs.fn << "\n";
 }
-void ValuePrinter::declare(op_type ret_type, string name, vector<op_type> args) {
-	declare(*stream, ret_type, name, args);
+void ValuePrinter::declare(op_type ret_type, string name, vector<op_type> args,
+		const func_attrs &attrs) {
+	declare(*stream, ret_type, name, args, attrs);
 }
 
 /* Type definition
@@ -111,9 +193,10 @@ void ValuePrinter::declare(op_type ret_type, string name, vector<op_type> args)
  */
 void ValuePrinter::type_define(ostream &o, string class_name, vector<op_type> attributes) {
 	check_ostream(o);
-	o << "%" << class_name << " = type {\n\t";
+	ir_out out(o);
+	out << "%" << class_name << " = type {\n\t";
 	for(unsigned i = 0; i < attributes.size(); ++i)
-		o <<  attributes[i].get_name() + (i + 1 < attributes.size() ? ",\n\t" : "\n}\n\n");
+		out << attributes[i] << (i + 1 < attributes.size() ? ",\n\t" : "\n}\n\n");
 }
 
 
@@ -123,7 +206,8 @@ void ValuePrinter::type_define(string class_name, vector<op_type> attributes) {
 
 void ValuePrinter::type_alias_define(ostream &o, string alias_name, op_type type){
 	check_ostream(o);
-	o << "%" << alias_name << " = type " << type.get_name() << "\n";
+	ir_out out(o);
+	out << "%" << alias_name << " = type " << type << "\n";
 }
 
 void ValuePrinter::type_alias_define(string alias_name, op_type type) {
@@ -132,30 +216,34 @@ void ValuePrinter::type_alias_define(string alias_name, op_type type) {
 
 
 /* Structure constant definition
- * Format constant_name = {
+ * Format constant_name = [internal] constant type {
  * 	attribute init_value,
  * 	...
  * 	}
  */
 void ValuePrinter::init_struct_constant(ostream &o, operand constant,
-                vector<op_type> field_types, vector<const_value> init_values) {
+                vector<op_type> field_types, vector<const_value> init_values,
+		bool internal) {
 	check_ostream(o);
-	o << constant.get_name() << " = constant " + constant.get_typename() + " {\n\t";
+	ir_out out(o);
+	out << constant << " = " << (internal ? "internal " : "") 
+	  << "constant " << constant.get_type() << " {\n\t";
 	for(unsigned i = 0; i < init_values.size(); ++i) {
-		o << field_types[i].get_name() + " ";
+		out << field_types[i] << " ";
 		if (init_values[i].get_type().get_id() == INT8 && field_types[i].get_id() == INT8_PTR)
-			embed_getelementptr(o, init_values[i].get_type(), 
+			embed_getelementptr(out, init_values[i].get_type(), 
 			    init_values[i], int_value(0), int_value(0));
 		else
-			o << init_values[i].get_value();
-		o << (i + 1 < init_values.size() ? ",\n\t" : "\n}\n\n");
+			out << init_values[i].get_value();
+		out << (i + 1 < init_values.size() ? ",\n\t" : "\n}\n\n");
 	}
 }
 
 
 void ValuePrinter::init_struct_constant(operand constant,
-      vector<op_type> field_types, vector<const_value> init_values) {
-	init_struct_constant(*stream, constant, field_types, init_values);
+      vector<op_type> field_types, vector<const_value> init_values,
+      bool internal) {
+	init_struct_constant(*stream, constant, field_types, init_values, internal);
 }
 
 
@@ -163,7 +251,8 @@ void ValuePrinter::init_struct_constant(operand constant,
 void ValuePrinter::begin_block(string label)
 {
 	check_ostream();
-	*stream << "\n" + label + ":\n";
+	ir_out out(*stream);
+	out << "\n" << label << ":\n";
 }
 
 /* Binary instruction
@@ -171,10 +260,11 @@ void ValuePrinter::begin_block(string label)
  */
 void ValuePrinter::bin_inst(ostream &o, string inst_name, operand op1, operand op2, operand result) {
 	check_ostream(o);
-	o  << "\t";	
+	ir_out out(o);
+	out << "\t";	
 	if (!result.is_empty())
-		o <<  result.get_name() + " = ";
-	o << inst_name + " " + op1.get_typename() + " "  + op1.get_name() + ", " + op2.get_name() + "\n";
+		out << result << " = ";
+	out << inst_name << " " << op1.get_type() << " " << op1 << ", " << op2 << "\n";
 }
 operand ValuePrinter::bin_inst(string inst_name, operand op1, operand op2) {
 	operand ret = make_fresh_operand(op1.get_type());
@@ -223,7 +313,8 @@ operand ValuePrinter::xor_in(operand op1, operand op2) {
  */
 void ValuePrinter::malloc_mem(ostream &o, int size, operand result) {
 	check_ostream(o);
-	o << "\t" + result.get_name() + " = call i8*  @malloc(i32 " << size << ")\n";
+	ir_out out(o);
+	out << "\t" << result << " = call i8*  @malloc(i32 " << size << ")\n";
 }
 
 operand ValuePrinter::malloc_mem(int size)
@@ -236,7 +327,8 @@ operand ValuePrinter::malloc_mem(int size)
 void ValuePrinter::malloc_mem(ostream &o, operand size, operand result)
 {
 	check_ostream(o);
-	o << "\t" + result.get_name() + " = call i8* @malloc(i32 " + size.get_name() + ")\n";
+	ir_out out(o);
+	out << "\t" << result << " = call i8* @malloc(i32 " << size << ")\n";
 }
 
 operand ValuePrinter::malloc_mem(operand size)
@@ -251,7 +343,8 @@ operand ValuePrinter::malloc_mem(operand size)
  */
 void ValuePrinter::alloca_mem(ostream &o, op_type type, operand result) {
 	check_ostream(o);
-	o << "\t" + result.get_name() + " = alloca " + type.get_name() + "\n";
+	ir_out out(o);
+	out << "\t" << result << " = alloca " << type << "\n";
 }
 operand ValuePrinter::alloca_mem(op_type type) {
 	operand result = make_fresh_operand(type.get_ptr_type());
@@ -259,31 +352,48 @@ operand ValuePrinter::alloca_mem(op_type type) {
 	return result;
 }
 
+/* Metadata attachments of a load or store */
+static void print_access_md(ir_out &out, const access_md &md)
+{
+	if (md.tbaa)
+		out << ", !tbaa !" << md.tbaa;
+	if (md.invariant_load)
+		out << ", !invariant.load !0";
+	if (md.invariant_group)
+		out << ", !invariant.group !0";
+}
+
 /* load instruction
  * Format: [result =] load type, op_type op_name
  */
-void ValuePrinter::load(ostream &o, op_type type, operand op, operand result) {
+void ValuePrinter::load(ostream &o, op_type type, operand op, operand result,
+		const access_md &md) {
 	check_ostream(o);
-	o << "\t";
-	o << result.get_name() + " = "; 
-	o << "load " + type.get_name() + ", " + op.get_typename() + " " + op.get_name() + "\n";
-}
-operand ValuePrinter::load(op_type type, operand op) {
-	operand result = make_fresh_operand(op.get_type().get_deref_type());
-	load(*stream, type, op, result);
+	ir_out out(o);
+	out << "\t" << result << " = "; 
+	out << "load " << type << ", " << op.get_type() << " " << op;
+	print_access_md(out, md);
+	out << "\n";
+}
+operand ValuePrinter::load(op_type type, operand op, const access_md &md) {
+	operand result = make_fresh_operand(type);
+	load(*stream, type, op, result, md);
 	return result;
 }
 
 /* store instruction
  * store op1_type op1_name, result_type result_name
  */
-void ValuePrinter::store(ostream &o, operand op, operand result) {
+void ValuePrinter::store(ostream &o, operand op, operand result, const access_md &md) {
 	check_ostream(o);
-	o << "\tstore " + op.get_typename() + " " + op.get_name() 
-	  + ", " + result.get_typename() + " " + result.get_name() + "\n";
+	ir_out out(o);
+	out << "\tstore " << op.get_type() << " " << op 
+	  << ", " << result.get_type() << " " << result;
+	print_access_md(out, md);
+	out << "\n";
 }
-void ValuePrinter::store(operand op, operand result) {
-	store(*stream, op, result);
+void ValuePrinter::store(operand op, operand result, const access_md &md) {
+	store(*stream, op, result, md);
 }
 
 /* getelementptr instruction
@@ -293,13 +403,14 @@ void ValuePrinter::store(operand op, operand result) {
  */
 void ValuePrinter::getelementptr(ostream &o, op_type type, operand op1, operand op2, operand op3, operand result) {
 	check_ostream(o);
-	o << "\t";
+	ir_out out(o);
+	out << "\t";
 	if (result.get_type().get_id() != VOID)
-		o << result.get_name() << " = ";
-	o << "getelementptr " + type.get_name() + ", " 
-	  + type.get_ptr_type_name() + " " + op1.get_name() + ", "
-	  + op2.get_typename() + " " + op2.get_name() + ", " 
-	  + op3.get_typename() + " " + op3.get_name() + "\n";
+		out << result << " = ";
+	out << "getelementptr " << type << ", " 
+	  << type << "* " << op1 << ", "
+	  << op2.get_type() << " " << op2 << ", " 
+	  << op3.get_type() << " " << op3 << "\n";
 }
 operand ValuePrinter::getelementptr(op_type type, operand op1, operand op2, operand op3, op_type result_type) {
 	operand result = make_fresh_operand(result_type);
@@ -312,12 +423,13 @@ operand ValuePrinter::getelementptr(op_type type, operand op1, operand op2, oper
  */
 void ValuePrinter::getelementptr(ostream &o, op_type type, operand op1, operand op2, operand result) {
 	check_ostream(o);
-	o << "\t";
+	ir_out out(o);
+	out << "\t";
 	if (result.get_type().get_id() != VOID)
-		o << result.get_name() << " = ";
-	o << "getelementptr " + type.get_name() + ", " 
-	  + type.get_ptr_type_name() + " " + op1.get_name() + ", "
-	  + op2.get_typename() + " " + op2.get_name() + "\n";
+		out << result << " = ";
+	out << "getelementptr " << type << ", " 
+	  << type << "* " << op1 << ", "
+	  << op2.get_type() << " " << op2 << "\n";
 }
 operand ValuePrinter::getelementptr(op_type type, operand op1, operand op2, op_type result_type) {
 	operand result = make_fresh_operand(result_type);
@@ -332,14 +444,15 @@ operand ValuePrinter::getelementptr(op_type type, operand op1, operand op2, op_t
  */
 void ValuePrinter::getelementptr(ostream &o, op_type type, operand op1, operand op2, operand op3, operand op4, operand result) {
 	check_ostream(o);
-	o << "\t";
+	ir_out out(o);
+	out << "\t";
 	if (result.get_type().get_id() != VOID)
-		o << result.get_name() << " = ";
-	o << "getelementptr " + type.get_name() + ", " 
-	  + type.get_ptr_type_name() + " " + op1.get_name() + ", "
-	  + op2.get_typename() + " " + op2.get_name() + ", " 
-	  + op3.get_typename() + " " + op3.get_name() + ", " 
-	  + op4.get_typename() + " " + op4.get_name() + "\n";
+		out << result << " = ";
+	out << "getelementptr " << type << ", " 
+	  << type << "* " << op1 << ", "
+	  << op2.get_type() << " " << op2 << ", " 
+	  << op3.get_type() << " " << op3 << ", " 
+	  << op4.get_type() << " " << op4 << "\n";
 }
 operand ValuePrinter::getelementptr(op_type type, operand op1, operand op2, operand op3, operand op4, op_type result_type) {
 	operand result = make_fresh_operand(result_type);
@@ -349,15 +462,16 @@ operand ValuePrinter::getelementptr(op_type type, operand op1, operand op2, oper
 
 void ValuePrinter::getelementptr(ostream &o, op_type type, operand op1, operand op2, operand op3, operand op4, operand op5, operand result) {
 	check_ostream(o);
-	o << "\t";
+	ir_out out(o);
+	out << "\t";
 	if (result.get_type().get_id() != VOID)
-		o << result.get_name() << " = ";
-	o << "getelementptr " + type.get_name() + ", " 
-	  + type.get_ptr_type_name() + " " + op1.get_name() + ", "
-	  + op2.get_typename() + " " + op2.get_name() + ", " 
-	  + op3.get_typename() + " " + op3.get_name() + ", " 
-	  + op4.get_typename() + " " + op4.get_name() + ", " 
-	  + op5.get_typename() + " " + op5.get_name() + "\n";
+		out << result << " = ";
+	out << "getelementptr " << type << ", " 
+	  << type << "* " << op1 << ", "
+	  << op2.get_type() << " " << op2 << ", " 
+	  << op3.get_type() << " " << op3 << ", " 
+	  << op4.get_type() << " " << op4 << ", " 
+	  << op5.get_type() << " " << op5 << "\n";
 }
 operand ValuePrinter::getelementptr(op_type type, operand op1, operand op2, operand op3, operand op4, operand op5, op_type result_type) {
 	operand result = make_fresh_operand(result_type);
@@ -368,20 +482,24 @@ operand ValuePrinter::getelementptr(op_type type, operand op1, operand op2, oper
 /* getelementptr that takes a variable number of operands */
 void ValuePrinter::getelementptr(ostream &o, op_type type, vector<operand> op, operand result) {
 	check_ostream(o);
-	o << "\t";
+	ir_out out(o);
+	out << "\t";
 	if (result.get_type().get_id() != VOID)
-		o << result.get_name() << " = ";
-	o << "getelementptr " + type.get_name() + ", ";
+		out << result << " = ";
+	out << "getelementptr " << type << ", ";
 	assert (op.size() > 0 && "no operands given to getelementptr");
 	for (unsigned i = 0; i < op.size(); ++i) {
 	        // first operand type must be type* and not op[0].get_typename()
-	        o << ((i == 0)? type.get_ptr_type_name() : op[i].get_typename());
-	        o << " " + op[i].get_name();
-		o << op[i].get_typename() + " " + op[i].get_name();
+		if (i == 0)
+			out << type << "*";
+		else
+			out << op[i].get_type();
+	        out << " " << op[i];
+		out << op[i].get_type() << " " << op[i];
 		if (i + 1 < op.size())
-			o << ", ";
+			out << ", ";
 	}
-	o << "\n";
+	out << "\n";
 }
 operand ValuePrinter::getelementptr(op_type type, vector<operand> op, op_type result_type) {
 	operand result = make_fresh_operand(result_type);
@@ -390,11 +508,11 @@ operand ValuePrinter::getelementptr(op_type type, vector<operand> op, op_type re
 }
 
 /* simple version of getelemenptr suitable for embedding */
-static void embed_getelementptr (ostream &o, op_type type, operand op1, operand op2, operand op3) {
-	o << "getelementptr (" + type.get_name() + ", "
-	  + op1.get_typename() + "* " + op1.get_name() + ", "
-	  + op2.get_typename() + " " + op2.get_name() + ", "
-	  + op3.get_typename() + " " + op3.get_name() + ")";
+static void embed_getelementptr (ir_out &o, op_type type, operand op1, operand op2, operand op3) {
+	o << "getelementptr (" << type << ", "
+	  << op1.get_type() << "* " << op1 << ", "
+	  << op2.get_type() << " " << op2 << ", "
+	  << op3.get_type() << " " << op3 << ")";
 }
 
 /* select instruction
@@ -402,10 +520,11 @@ static void embed_getelementptr (ostream &o, op_type type, operand op1, operand
  */
 void ValuePrinter::select(ostream &o, operand op1, operand op2, operand op3, operand result) {
 	check_ostream(o);
-	o << "\t" + result.get_name() + " = select "
-	  + op1.get_typename() + " " + op1.get_name() + ", " 
-	  + op2.get_typename() + " " + op2.get_name() + ", "
-	  + op3.get_typename() + " " + op3.get_name() + "\n";
+	ir_out out(o);
+	out << "\t" << result << " = select "
+	  << op1.get_type() << " " << op1 << ", " 
+	  << op2.get_type() << " " << op2 << ", "
+	  << op3.get_type() << " " << op3 << "\n";
 }
 operand ValuePrinter::select(operand op1, operand op2, operand op3) {
 	operand result = make_fresh_operand(op2.get_type());
@@ -414,15 +533,21 @@ operand ValuePrinter::select(operand op1, operand op2, operand op3) {
 }
 
 /* Conditional branch instruction
- * Format: br op_type op_value, label %true_label, label %false_label
+ * Format: br op_type op_value, label %true_label, label %false_label [, !prof !N]
  */
-void ValuePrinter::branch_cond(ostream &o, operand op, label label_true, label label_false) {
+void ValuePrinter::branch_cond(ostream &o, operand op, label label_true, label label_false,
+		int prof) {
 	check_ostream(o);
-	o << "\tbr " + op.get_typename() + " " + op.get_name() + ", label %" + label_true 
-	  + ", label %" + label_false + "\n";
+	ir_out out(o);
+	out << "\tbr " << op.get_type() << " " << op << ", label %" << label_true 
+	  << ", label %" << label_false;
+	if (prof)
+		out << ", !prof !" << prof;
+	out << "\n";
 }
-void ValuePrinter::branch_cond(operand op, label label_true, label label_false) {
-	branch_cond(*stream, op, label_true, label_false);
+void ValuePrinter::branch_cond(operand op, label label_true, label label_false,
+		int prof) {
+	branch_cond(*stream, op, label_true, label_false, prof);
 }
 
 /* Unconditional branch instruction
@@ -430,41 +555,68 @@ void ValuePrinter::branch_cond(operand op, label label_true, label label_false)
  */
 void ValuePrinter::branch_uncond(ostream &o, label l) {
 	check_ostream(o);
-	o << "\tbr label %" + l + "\n";
+	ir_out out(o);
+	out << "\tbr label %" << l << "\n";
 }
 void ValuePrinter::branch_uncond(label l) {
 	branch_uncond(*stream, l);
 }
 
+/* Switch instruction
+ * Format: switch op_type op_value, label %default [ op_type value, label %label ... ]
+ */
+void ValuePrinter::switch_in(ostream &o, operand op, label label_default, 
+		vector<operand> values, vector<label> labels) {
+	check_ostream(o);
+	ir_out out(o);
+	out << "\tswitch " << op.get_type() << " " << op << ", label %" << label_default 
+	  << " [\n";
+	for (unsigned i = 0; i < values.size(); ++i)
+		out << "\t\t" << values[i].get_type() << " " << values[i] 
+		  << ", label %" << labels[i] << "\n";
+	out << "\t]\n";
+}
+void ValuePrinter::switch_in(operand op, label label_default, 
+		vector<operand> values, vector<label> labels) {
+	switch_in(*stream, op, label_default, values, labels);
+}
+
 /* icmp instruction
  * Format: result_name = icmp icmp_val type op1_name, op2_name
  */
 void ValuePrinter::icmp(ostream &o, icmp_val v, operand op1, operand op2, operand result) {
 	check_ostream(o);
-	o << "\t" + result.get_name() + " = icmp ";
+	ir_out out(o);
+	out << "\t" << result << " = icmp ";
 	switch(v) {
 		case EQ:
-			o << "eq";
+			out << "eq";
 			break;
 		case LT:
-			o << "slt";
+			out << "slt";
 			break;
 		case LE:
-			o << "sle";
+			out << "sle";
 			break;
 		case GT:
-			o << "sgt";
+			out << "sgt";
 			break;
 		case GE:
-			o << "sge";
+			out << "sge";
 			break;
 		case NE:
-			o << "ne";
+			out << "ne";
 			break;	
+		case ULT:
+			out << "ult";
+			break;
+		case UGT:
+			out << "ugt";
+			break;
 		default:
 			assert(0 && "Bad icmp opcode");
 	}
-	o << " " + op1.get_typename() + " " + op1.get_name() + ", " + op2.get_name() + "\n";
+	out << " " << op1.get_type() << " " << op1 << ", " << op2 << "\n";
 }
 operand ValuePrinter::icmp(icmp_val v, operand op1, operand op2) {
 	operand result = make_fresh_operand(op_type(INT1));
@@ -476,27 +628,31 @@ operand ValuePrinter::icmp(icmp_val v, operand op1, operand op2) {
  * Format: call result_return_type arg_types @function_name(arg1_type arg1_name, ...)
  */
 void ValuePrinter::call(ostream &o, vector<op_type> arg_types, string fn_name, 
-			bool is_global, vector<operand> args, operand result_op) {
+			bool is_global, vector<operand> args, operand result_op,
+			call_conv cc, bool tail) {
 	check_ostream(o);
-	o << "\t";	
+	ir_out out(o);
+	out << "\t";	
 	if (result_op.get_type().get_id() != VOID)
-		o << result_op.get_name() << " = ";
-	o << "call " + result_op.get_typename();
+		out << result_op << " = ";
+	out << (tail ? "tail call " : "call ") << (cc == FASTCC ? "fastcc " : "")
+	  << result_op.get_type();
 	if (arg_types.size() > 0) {
-		o << "(";
+		out << "(";
 		for (unsigned i = 0; i < arg_types.size(); ++i)
-			o << arg_types[i].get_name() << (i + 1 < arg_types.size() ? ", " : "");
-		o << " )";
+			out << arg_types[i] << (i + 1 < arg_types.size() ? ", " : "");
+		out << " )";
 	}
-	o << (is_global?" @":" %") + fn_name + "( ";
+	out << (is_global?" @":" %") << fn_name << "( ";
 	for (unsigned i = 0; i < args.size(); ++i)
-		o << args[i].get_typename() + " " + args[i].get_name() + (i + 1 < args.size() ? ", " : "");
-	o << " )\n";
+		out << args[i].get_type() << " " << args[i] << (i + 1 < args.size() ? ", " : "");
+	out << " )\n";
 }
 operand ValuePrinter::call(vector<op_type> arg_types, op_type result_type,
-      string fn_name, bool is_global, vector<operand> args) {
+      string fn_name, bool is_global, vector<operand> args,
+      call_conv cc, bool tail) {
 	operand result = make_fresh_operand(result_type);
-	call(*stream, arg_types, fn_name, is_global, args, result);
+	call(*stream, arg_types, fn_name, is_global, args, result, cc, tail);
 	return result;
 }
 
@@ -505,11 +661,12 @@ operand ValuePrinter::call(vector<op_type> arg_types, op_type result_type,
  */
 void ValuePrinter::ret(ostream &o, operand op) {
 	check_ostream(o);
-	o << "\tret ";
+	ir_out out(o);
+	out << "\tret ";
 	if (op.get_type().get_id() != VOID)
-		o << op.get_typename() + " " + op.get_name() + "\n";
+		out << op.get_type() << " " << op << "\n";
 	else 
-		o << "void\n";
+		out << "void\n";
 }
 void ValuePrinter::ret(operand op) {
 	ret(*stream, op);
@@ -520,8 +677,9 @@ void ValuePrinter::ret(operand op) {
  */
 void ValuePrinter::bitcast(ostream &o, operand op, op_type new_type, operand result) {
 	check_ostream(o);
-	o << "\t" << result.get_name() << " = bitcast " << op.get_typename() << " " << op.get_name()
-	  << " to " << new_type.get_name() << "\n";
+	ir_out out(o);
+	out << "\t" << result << " = bitcast " << op.get_type() << " " << op
+	  << " to " << new_type << "\n";
 }
 operand ValuePrinter::bitcast(operand op, op_type new_type) {
 	operand result = make_fresh_operand(new_type);
@@ -534,8 +692,9 @@ operand ValuePrinter::bitcast(operand op, op_type new_type) {
  */
 void ValuePrinter::ptrtoint(ostream &o, operand op, op_type new_type, operand result) {
 	check_ostream(o);
-	o << "\t" << result.get_name() << " = ptrtoint " << op.get_typename() << " " << op.get_name()
-	  << " to " << new_type.get_name() << "\n";
+	ir_out out(o);
+	out << "\t" << result << " = ptrtoint " << op.get_type() << " " << op
+	  << " to " << new_type << "\n";
 }
 operand ValuePrinter::ptrtoint(operand op, op_type new_type) {
 	operand result = make_fresh_operand(new_type);
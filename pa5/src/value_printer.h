@@ -12,8 +12,38 @@
 #include <vector>
 
 typedef string label;
-/* Values acceptable by the icmp instruction */
-typedef enum {EQ, NE, LT, LE, GT, GE} icmp_val;
+/* Values acceptable by the icmp instruction; ULT and UGT are unsigned */
+typedef enum {EQ, NE, LT, LE, GT, GE, ULT, UGT} icmp_val;
+
+/* Calling conventions of generated functions */
+typedef enum {CCC, FASTCC} call_conv;
+
+/* Linkage and attributes of a function definition or declaration.
+ * Attribute lists are spelled as in LLVM assembly, e.g. "nonnull" or
+ * "noreturn cold"; params[i] applies to the i-th parameter. */
+struct func_attrs {
+	bool internal;
+	call_conv cc;
+	string ret;
+	vector<string> params;
+	string fn;
+	string gc;	/* collector strategy of a definition, e.g. "shadow-stack" */
+	func_attrs(call_conv c = CCC) : internal(false), cc(c) {}
+};
+
+/* Metadata attached to a load or store: a TBAA access tag (0 for none)
+ * and the invariant.load/invariant.group markers.  The code generator
+ * must define !0 as the empty node. */
+struct access_md {
+	int tbaa;
+	bool invariant_load;
+	bool invariant_group;
+	access_md(int t = 0, bool load = false, bool group = false)
+	  : tbaa(t), invariant_load(load), invariant_group(group) {}
+};
+
+/* Restart the numbering of fresh temporaries on the calling thread */
+void reset_fresh_operands();
 
 class ValuePrinter {
 	private:
@@ -38,12 +68,20 @@ class ValuePrinter {
 		/* External constant declaration */
 		void init_ext_constant(ostream &o, string name, op_type type);
 		void init_ext_constant(string name, op_type type);
+		/* External variable declaration */
+		void init_ext_global(ostream &o, string name, op_type type, 
+			bool tls = false);
+		void init_ext_global(string name, op_type type, bool tls = false);
 		
 		/* Function definitions and declarations */
-		void declare(ostream &o, op_type ret_type, string name, vector<op_type> args);
-		void declare(op_type ret_type, string name, vector<op_type> args);
-		void define(ostream &o, op_type ret_type, string name, vector<operand> args);
-		void define(op_type ret_type, string name, vector<operand> args);
+		void declare(ostream &o, op_type ret_type, string name, vector<op_type> args,
+			const func_attrs &attrs = func_attrs());
+		void declare(op_type ret_type, string name, vector<op_type> args,
+			const func_attrs &attrs = func_attrs());
+		void define(ostream &o, op_type ret_type, string name, vector<operand> args,
+			const func_attrs &attrs = func_attrs());
+		void define(op_type ret_type, string name, vector<operand> args,
+			const func_attrs &attrs = func_attrs());
 		void end_define(ostream &o) { check_ostream(o); o << "}\n\n"; }
 		void end_define() { *stream << "}\n\n"; }
 
@@ -56,9 +94,11 @@ class ValuePrinter {
 
 		/* Structure constant definition */
 		void init_struct_constant(ostream &o, operand constant,
-			vector<op_type> field_types, vector<const_value> init_values);
+			vector<op_type> field_types, vector<const_value> init_values,
+			bool internal = false);
 		void init_struct_constant(operand constant,
-			vector<op_type> field_types, vector<const_value> init_values);
+			vector<op_type> field_types, vector<const_value> init_values,
+			bool internal = false);
 
 	/* Print a label */
 	void begin_block(string label);
@@ -83,8 +123,10 @@ class ValuePrinter {
 		void malloc_mem(ostream &o, int size, operand result);
 		void malloc_mem(ostream &o, operand size, operand result);
 		void alloca_mem(ostream &o, op_type type, operand op2);
-		void load(ostream &o, op_type type, operand op, operand op2);
-		void store(ostream &o, operand op, operand op2);
+		void load(ostream &o, op_type type, operand op, operand op2,
+			const access_md &md = access_md());
+		void store(ostream &o, operand op, operand op2,
+			const access_md &md = access_md());
 		void getelementptr(ostream &o, op_type type, operand op1, operand op2, operand result);
 		void getelementptr(ostream &o, op_type type, operand op1, operand op2, operand op3, operand result);
 		void getelementptr(ostream &o, op_type type, operand op1, operand op2, operand op3, operand op4, operand result);
@@ -94,10 +136,10 @@ class ValuePrinter {
 		operand malloc_mem(int size);
 		operand malloc_mem(operand size);
 		operand alloca_mem(op_type type);
-		operand load(op_type type, operand op);
+		operand load(op_type type, operand op, const access_md &md = access_md());
 
 		/* store does not produce a result */
-		void store(operand op, operand op2);
+		void store(operand op, operand op2, const access_md &md = access_md());
 
 		/* getelementptr continues to requre an argument for the result type,
 		   becuase it is difficult to compute. */
@@ -108,13 +150,20 @@ class ValuePrinter {
 		operand getelementptr(op_type type, vector<operand> op, op_type result_type);
 
 		/* Terminator instructions */
-		void branch_cond(ostream &o, operand op, label label_true, label label_false);
+		void branch_cond(ostream &o, operand op, label label_true, label label_false,
+			int prof = 0);
 		void branch_uncond(ostream &o, string label);
+		void switch_in(ostream &o, operand op, label label_default, 
+			vector<operand> values, vector<label> labels);
 		void ret(ostream &o, operand op);
 		void unreachable(ostream &o) { check_ostream(o); o << "\tunreachable\n"; }
 
-		void branch_cond(operand op, label label_true, label label_false);
+		/* prof names a branch_weights node, 0 for none */
+		void branch_cond(operand op, label label_true, label label_false,
+			int prof = 0);
 		void branch_uncond(string label);
+		void switch_in(operand op, label label_default, 
+			vector<operand> values, vector<label> labels);
 		void ret(operand op);
 		void unreachable() { unreachable(*stream); }
 
@@ -122,14 +171,16 @@ class ValuePrinter {
 		void select(ostream &o, operand op1, operand op2, operand op3, operand result);
 		void icmp(ostream &o, icmp_val v, operand op1, operand op2, operand result);
 		void call(ostream &o, vector<op_type> arg_types, string fn_name,
-			bool is_global, vector<operand> args, operand result);
+			bool is_global, vector<operand> args, operand result,
+			call_conv cc = CCC, bool tail = false);
 		void bitcast(ostream &o, operand op, op_type new_type, operand result);
 		void ptrtoint(ostream &o, operand op, op_type new_type, operand result);
 
 		operand select(operand op1, operand op2, operand op3);
 		operand icmp(icmp_val v, operand op1, operand op2);
 		operand call(vector<op_type> arg_types, op_type result_type,
-			string fn_name, bool is_global, vector<operand> args);
+			string fn_name, bool is_global, vector<operand> args,
+			call_conv cc = CCC, bool tail = false);
 		operand bitcast(operand op, op_type new_type);
 		operand ptrtoint(operand op, op_type new_type);
 };
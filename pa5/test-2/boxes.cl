@@ -0,0 +1,46 @@
+(* Ints in -128..1023 and both Bools are boxed by static objects, other
+   Ints by new ones.  Boxes of both kinds are held across collections. *)
+class Cell {
+	v : Object;
+	next : Cell;
+	init(x : Object, n : Cell) : Cell { { v <- x; next <- n; self; } };
+	v() : Object { v };
+	next() : Cell { next };
+};
+
+class Main inherits IO {
+	boxed(i : Int) : Object { i };
+	boxed_bool(x : Bool) : Object { x };
+
+	churn(n : Int) : Object {
+		let l : Cell in
+			while 0 < n loop { l <- (new Cell).init("x".concat("y"), l); n <- n - 1; } pool
+	};
+
+	main() : Object {
+		let cells : Cell, i : Int <- ~200, sum : Int <- 0, same : Int <- 0, 
+		    b : Object <- true, z : Object <- new Int in {
+			while i < 1200 loop {
+				cells <- (new Cell).init(boxed(i), cells);
+				cells <- (new Cell).init(i < 500, cells);
+				i <- i + 50;
+			} pool;
+			churn(3000);
+			let c : Cell <- cells in
+				while not isvoid c loop {
+					case c.v() of
+						n : Int => { sum <- sum + n; if c.v() = boxed(n) then same <- same + 1 else 0 fi; };
+						t : Bool => if t then sum <- sum + 1000000 else sum fi;
+					esac;
+					c <- c.next();
+				} pool;
+			out_int(sum); out_string(" "); out_int(same); out_string(" ");
+			out_string(z.type_name()); out_string(" ");
+			out_string(if b = boxed_bool(1 < 2) then "t" else "f" fi);
+			out_string(if boxed(1023) = boxed(1023) then "t" else "f" fi);
+			out_string(if boxed(1024) = boxed(1024) then "t" else "f" fi);
+			out_string(if boxed(5).copy() = boxed(5) then "t" else "f" fi);
+			out_string("\n");
+		}
+	};
+};
@@ -0,0 +1,72 @@
+-- case over a class hierarchy: every object is matched against branches
+-- that nest (Shape, Polygon, Square) and branches on disjoint subtrees,
+-- so that the innermost branch containing the dynamic class is taken.
+-- Boxed Ints, Bools and Strings are matched as objects too.
+
+class Shape {
+   name() : String { "shape" };
+};
+class Circle inherits Shape {
+   name() : String { "circle" };
+};
+class Polygon inherits Shape {
+   name() : String { "polygon" };
+};
+class Triangle inherits Polygon {
+   name() : String { "triangle" };
+};
+class Quad inherits Polygon {
+   name() : String { "quad" };
+};
+class Square inherits Quad {
+   name() : String { "square" };
+};
+class Ellipse inherits Circle {
+   name() : String { "ellipse" };
+};
+
+class Main inherits IO {
+   classify(x : Object) : String {
+      case x of
+         s : Square => "a square";
+         p : Polygon => "a polygon (".concat(p.name()).concat(")");
+         c : Circle => "round (".concat(c.name()).concat(")");
+         sh : Shape => "some shape";
+         i : Int => "the int ".concat(if i < 10 then "small" else "big" fi);
+         b : Bool => if b then "true" else "false" fi;
+         str : String => "the string ".concat(str);
+         o : Object => "something else";
+      esac
+   };
+
+   -- Only two branches over the whole tree: found by binary search
+   sides(x : Shape) : Int {
+      case x of
+         t : Triangle => 3;
+         q : Quad => 4;
+         s : Shape => 0;
+      esac
+   };
+
+   show(x : Object) : IO {
+      out_string(classify(x)).out_string("\n")
+   };
+
+   main() : Object {{
+      show(new Shape);
+      show(new Circle);
+      show(new Ellipse);
+      show(new Polygon);
+      show(new Triangle);
+      show(new Quad);
+      show(new Square);
+      show(3);
+      show(2000);
+      show(true);
+      show("abc");
+      show(new IO);
+      show(self);
+      out_int(sides(new Triangle) + sides(new Square) * 10 + sides(new Circle) * 100);
+      out_string("\n");
+   }};
+};
@@ -0,0 +1,28 @@
+-- Dispatch to methods of classes that are never instantiated.  Their
+-- definitions are removed, so the calls can only be reached with a
+-- void receiver and compile to the void check alone.  Static dispatch
+-- keeps its target, and must still check the receiver.
+
+class A {
+   f() : Int { 1 };
+};
+class B inherits A {
+   f() : Int { 2 };
+};
+class C {
+   g() : Int { 3 };
+};
+
+class Main inherits IO {
+   a : A;
+   b : B;
+   c : C;
+   main() : Object {
+      {
+         if isvoid a then out_string("void a\n") else out_int(a.f()) fi;
+         if isvoid b then out_string("void b\n") else out_int(b.f()) fi;
+         if isvoid c then out_string("void c\n") else out_int(c@C.g()) fi;
+         out_int(a.f());
+      }
+   };
+};
@@ -0,0 +1,61 @@
+(* Builds and drops lists so that the collectors run many times.  An old
+   list keeps being updated with new nodes, which the generational
+   collector only finds through its card table. *)
+class Node {
+	val : Object;
+	next : Node;
+	init(v : Object, n : Node) : Node { { val <- v; next <- n; self; } };
+	val() : Object { val };
+	next() : Node { next };
+	set_next(n : Node) : Node { next <- n };
+};
+
+class Main inherits IO {
+	keep : Node;
+
+	value(i : Int) : Object {
+		if i - i / 3 * 3 = 0 then i * 1000
+		else if i - i / 3 * 3 = 1 then "s".concat(i.type_name())
+		else i / 2 * 2 = i fi fi
+	};
+
+	build(n : Int) : Node {
+		let l : Node, i : Int <- 0 in {
+			while i < n loop {
+				l <- (new Node).init(value(i), l);
+				i <- i + 1;
+			} pool;
+			l;
+		}
+	};
+
+	sum(l : Node) : Int {
+		let s : Int <- 0 in {
+			while not isvoid l loop {
+				case l.val() of
+					i : Int => s <- s + i / 1000;
+					t : String => s <- s + t.length();
+					b : Bool => if b then s <- s + 1 else s fi;
+				esac;
+				l <- l.next();
+			} pool;
+			s;
+		}
+	};
+
+	main() : Object {
+		let round : Int <- 0, total : Int <- 0 in {
+			keep <- build(100);
+			while round < 200 loop {
+				-- Garbage, and one young node hung off the old list
+				total <- total + sum(build(500));
+				keep.set_next((new Node).init(round * 1000, keep.next()));
+				round <- round + 1;
+			} pool;
+			out_int(total);
+			out_string(" ");
+			out_int(sum(keep));
+			out_string("\n");
+		}
+	};
+};
@@ -0,0 +1,21 @@
+-- Division wraps around like the other Int operations: the smallest Int
+-- divided by -1 is itself, whether the operands are constants or not.
+
+class Main inherits IO {
+   min : Int <- ~2147483647 - 1;
+   m1 : Int <- ~1;
+
+   div(a : Int, b : Int) : Int { a / b };
+
+   main() : Object {
+      {
+         out_int((~2147483647 - 1) / ~1); out_string("\n");
+         out_int(min / m1); out_string("\n");
+         out_int(div(min, ~1)); out_string("\n");
+         out_int(div(min + 1, ~1)); out_string("\n");
+         out_int(div(~7, 2)); out_string(" ");
+         out_int(div(7, ~2)); out_string(" ");
+         out_int(div(7, ~1)); out_string("\n");
+      }
+   };
+};
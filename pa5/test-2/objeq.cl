@@ -0,0 +1,34 @@
+(* = on Objects compares Int, Bool and String boxes by value *)
+class A { };
+
+class Main inherits IO {
+	show(b : Bool) : IO {
+		if b then out_string("t") else out_string("f") fi
+	};
+
+	same(x : Object, y : Object) : Bool { x = y };
+
+	main() : Object {
+		let a : A <- new A, v : Object, s : String <- "ab" in {
+			show(same(5, 5));
+			show(same(2000, 2000));
+			show(same(100000, 99999 + 1));
+			show(same(2000, 2001));
+			show(same(~500, ~500));
+			show(same(true, true));
+			show(same(true, false));
+			show(same("abc", "abc"));
+			show(same(s.concat("c"), "abc"));
+			show(same("abc", "abd"));
+			show(same(5, "5"));
+			show(same(1, true));
+			show(same(a, a));
+			show(same(a, new A));
+			show(same(v, v));
+			show(same(v, 0));
+			show(same(0, v));
+			show(same(v, a));
+			out_string("\n");
+		}
+	};
+};
@@ -0,0 +1,92 @@
+-- String-keyed lookups: a table of keys of several lengths, probed with
+-- keys built afresh each time, so that = compares contents and not
+-- objects.  Most probes fail on the length or on the chars; the literal
+-- comparisons at the end are folded by the compiler.
+--
+--     make strmap.exe && time ./strmap.exe
+
+class Entry {
+   key : String;
+   value : Int;
+   next : Entry;
+
+   init(k : String, v : Int, n : Entry) : Entry {{
+      key <- k;
+      value <- v;
+      next <- n;
+      self;
+   }};
+
+   key() : String { key };
+   value() : Int { value };
+   next() : Entry { next };
+};
+
+class Table {
+   head : Entry;
+
+   add(k : String, v : Int) : Table {{
+      head <- (new Entry).init(k, v, head);
+      self;
+   }};
+
+   -- The value of k, or ~1
+   find(k : String) : Int {
+      let e : Entry <- head, r : Int <- ~1 in {
+         while (if isvoid e then false else r = ~1 fi) loop
+            if e.key() = k then r <- e.value() else e <- e.next() fi
+         pool;
+         r;
+      }
+   };
+};
+
+class Main inherits IO {
+   digits : String <- "0123456789";
+
+   i2a(i : Int) : String {
+      if i = 0 then "0" else i2a_aux(i) fi
+   };
+
+   i2a_aux(i : Int) : String {
+      if i = 0 then "" else
+         let next : Int <- i / 10 in
+            i2a_aux(next).concat(digits.substr(i - next * 10, 1))
+      fi
+   };
+
+   -- Keys of different lengths: k7, key-1234, a-longer-key-77, ...
+   key(i : Int) : String {
+      let p : Int <- i - (i / 3) * 3 in
+         if p = 0 then "k".concat(i2a(i)) else
+         if p = 1 then "key-".concat(i2a(i * 7)) else
+            "a-longer-key-".concat(i2a(i))
+         fi fi
+   };
+
+   main() : Object {
+      let t : Table <- new Table, n : Int <- 300, i : Int, round : Int,
+          sum : Int, misses : Int in {
+         while i < n loop {
+            t.add(key(i), i);
+            i <- i + 1;
+         } pool;
+         while round < 100 loop {
+            i <- 0;
+            while i < n loop {
+               sum <- sum + t.find(key(i));
+               if t.find(key(i + n)) = ~1 then misses <- misses + 1 else 0 fi;
+               i <- i + 1;
+            } pool;
+            round <- round + 1;
+         } pool;
+         out_int(sum);
+         out_string("\n");
+         out_int(misses);
+         out_string("\n");
+         if "abc" = "abc" then
+            if "abc" = "abd" then out_string("wrong\n") else out_string("ok\n") fi
+         else out_string("wrong\n") fi;
+      }
+   };
+};